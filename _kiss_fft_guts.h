@@ -25,13 +25,60 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
  4*4*4*2
  */
 
+/* Float builds for x86-64 under gcc or clang carry AVX2 and AVX-512 butterflies as well,
+   and kiss_fft_alloc picks whichever the cpu runs. */
+#if defined(KISS_FFT_SCALAR_FLOAT) && !defined(KISS_FFT_NO_DISPATCH) \
+    && defined(__GNUC__) && defined(__x86_64__)
+#define KISS_FFT_DISPATCH
+#define KF_SIMD_NONE 0
+#define KF_SIMD_AVX2 1
+#define KF_SIMD_AVX512 2
+#define KF_SIMD_MIN 4 /* stages of shorter sub-ffts stay scalar */
+#endif
+
+/* Bluestein's algorithm for a stage's length p transforms: a circular convolution of
+   length len with the chirp W^(n*n/2), itself done by fft. Plain float builds only,
+   the others keep the direct path. */
+#if !defined(USE_SIMD) && !defined(FIXED_POINT)
+#define KF_BLUESTEIN
+struct kf_bluestein{
+    int len; /* a fast size from 2p-1 up */
+    kiss_fft_cpx * chirp; /* [p] */
+    kiss_fft_cpx * filter; /* [len], fft of the conjugate chirp wrapped around, over len */
+    kiss_fft_cfg fft, ifft;
+};
+#endif
+
 struct kiss_fft_state{
     int nfft;
     int inverse;
     int factors[2*MAXFACTORS];
+    /* From kiss_fft_alloc_fourstep, or above KISS_FFT_FOURSTEP_MIN, nfft = r*c with r the largest factor up to sqrt(nfft),
+       done four step: r transforms of length c (rows), a twiddle, c of length r (cols).
+       Otherwise rows and cols are NULL. */
+    kiss_fft_cfg rows, cols;
+    kiss_fft_cpx * fourstep_twiddles; /* [r][c], twiddles[i*j] */
+#ifdef KF_BLUESTEIN
+    struct kf_bluestein * bluestein[MAXFACTORS]; /* per stage, or NULL */
+#endif
+    int bluestein_work; /* 2*len of the largest, the scratch points a call needs, or 0 */
+    int nested; /* a Bluestein convolution's: kf_work and kf_fourstep never fork for it */
+#ifdef KISS_FFT_DISPATCH
+    int simd;
+    /* per stage, twiddles[fstride*q*k] as [p-1][m], or NULL where the stage stays scalar.
+       They live past the end of twiddles. */
+    kiss_fft_cpx * stage_twiddles[MAXFACTORS];
+#endif
     kiss_fft_cpx twiddles[1];
 };
 
+#ifdef KISS_FFT_DISPATCH
+/* kiss_fftr's split and merge loops in vectors for k from 1, returning the k to carry on
+   from in scalar */
+int kf_simd_split(const kiss_fft_cfg st,const kiss_fft_cpx *tmpbuf,const kiss_fft_cpx *super_twiddles,kiss_fft_cpx *freqdata);
+int kf_simd_merge(const kiss_fft_cfg st,const kiss_fft_cpx *freqdata,const kiss_fft_cpx *super_twiddles,kiss_fft_cpx *tmpbuf);
+#endif
+
 /*
   Explanation of macros dealing with complex math:
 
@@ -0,0 +1,131 @@
+/*
+ Vector versions of the radix 2, 3, 4 and 5 butterflies and of kiss_fftr's split and
+ merge loops, KF_W complex at a time across k within a single transform. kiss_fft.c
+ includes this once per instruction set, having defined
+
+   KF_TARGET   the function attribute that builds for it
+   KF_W        complex per vector
+   V(name)     the name for this instruction set's copy of name
+
+ and V(v), the vector type, with helpers V(load)(p,n), V(store)(p,v,n), V(add), V(sub),
+ V(scale)(v,s), V(cmul)(a,b), V(muli)(v) for i*v, V(conj) and V(rev) for the complex in
+ reverse order. load and store only touch the first n of the KF_W complex.
+ */
+
+static KF_TARGET void V(bfly2)(kiss_fft_cpx * Fout, const kiss_fft_cpx * tw, int m)
+{
+    int k;
+    for (k=0; k<m; k+=KF_W) {
+        const int n = m - k < KF_W ? m - k : KF_W;
+        const V(v) f0 = V(load)(Fout+k, n);
+        const V(v) t = V(cmul)(V(load)(Fout+m+k, n), V(load)(tw+k, n));
+        V(store)(Fout+m+k, V(sub)(f0, t), n);
+        V(store)(Fout+k, V(add)(f0, t), n);
+    }
+}
+
+static KF_TARGET void V(bfly3)(kiss_fft_cpx * Fout, const kiss_fft_cpx * tw, int m, kiss_fft_scalar epi3i)
+{
+    int k;
+    for (k=0; k<m; k+=KF_W) {
+        const int n = m - k < KF_W ? m - k : KF_W;
+        const V(v) f0 = V(load)(Fout+k, n);
+        const V(v) s1 = V(cmul)(V(load)(Fout+m+k, n), V(load)(tw+k, n));
+        const V(v) s2 = V(cmul)(V(load)(Fout+2*m+k, n), V(load)(tw+m+k, n));
+        const V(v) s3 = V(add)(s1, s2);
+        const V(v) s0 = V(muli)(V(scale)(V(sub)(s1, s2), epi3i));
+        const V(v) fm = V(sub)(f0, V(scale)(s3, .5f));
+        V(store)(Fout+k, V(add)(f0, s3), n);
+        V(store)(Fout+m+k, V(add)(fm, s0), n);
+        V(store)(Fout+2*m+k, V(sub)(fm, s0), n);
+    }
+}
+
+static KF_TARGET void V(bfly4)(kiss_fft_cpx * Fout, const kiss_fft_cpx * tw, int m, int inverse)
+{
+    int k;
+    for (k=0; k<m; k+=KF_W) {
+        const int n = m - k < KF_W ? m - k : KF_W;
+        const V(v) f0 = V(load)(Fout+k, n);
+        const V(v) s0 = V(cmul)(V(load)(Fout+m+k, n), V(load)(tw+k, n));
+        const V(v) s1 = V(cmul)(V(load)(Fout+2*m+k, n), V(load)(tw+m+k, n));
+        const V(v) s2 = V(cmul)(V(load)(Fout+3*m+k, n), V(load)(tw+2*m+k, n));
+        const V(v) s5 = V(sub)(f0, s1);
+        const V(v) f = V(add)(f0, s1);
+        const V(v) s3 = V(add)(s0, s2);
+        const V(v) s4 = V(muli)(V(sub)(s0, s2));
+        V(store)(Fout+k, V(add)(f, s3), n);
+        V(store)(Fout+2*m+k, V(sub)(f, s3), n);
+        V(store)(Fout+m+k, inverse ? V(add)(s5, s4) : V(sub)(s5, s4), n);
+        V(store)(Fout+3*m+k, inverse ? V(sub)(s5, s4) : V(add)(s5, s4), n);
+    }
+}
+
+static KF_TARGET void V(bfly5)(kiss_fft_cpx * Fout, const kiss_fft_cpx * tw, int m, kiss_fft_cpx ya, kiss_fft_cpx yb)
+{
+    int k;
+    for (k=0; k<m; k+=KF_W) {
+        const int n = m - k < KF_W ? m - k : KF_W;
+        const V(v) s0 = V(load)(Fout+k, n);
+        const V(v) s1 = V(cmul)(V(load)(Fout+m+k, n), V(load)(tw+k, n));
+        const V(v) s2 = V(cmul)(V(load)(Fout+2*m+k, n), V(load)(tw+m+k, n));
+        const V(v) s3 = V(cmul)(V(load)(Fout+3*m+k, n), V(load)(tw+2*m+k, n));
+        const V(v) s4 = V(cmul)(V(load)(Fout+4*m+k, n), V(load)(tw+3*m+k, n));
+        const V(v) s7 = V(add)(s1, s4);
+        const V(v) s10 = V(sub)(s1, s4);
+        const V(v) s8 = V(add)(s2, s3);
+        const V(v) s9 = V(sub)(s2, s3);
+        const V(v) s5 = V(add)(V(add)(s0, V(scale)(s7, ya.r)), V(scale)(s8, yb.r));
+        const V(v) s6 = V(muli)(V(add)(V(scale)(s10, ya.i), V(scale)(s9, yb.i)));
+        const V(v) s11 = V(add)(V(add)(s0, V(scale)(s7, yb.r)), V(scale)(s8, ya.r));
+        const V(v) s12 = V(muli)(V(sub)(V(scale)(s10, yb.i), V(scale)(s9, ya.i)));
+        V(store)(Fout+k, V(add)(s0, V(add)(s7, s8)), n);
+        V(store)(Fout+m+k, V(add)(s5, s6), n);
+        V(store)(Fout+4*m+k, V(sub)(s5, s6), n);
+        V(store)(Fout+2*m+k, V(add)(s11, s12), n);
+        V(store)(Fout+3*m+k, V(sub)(s11, s12), n);
+    }
+}
+
+/* kf_bfly for p of 2 to 5, tw being the stage's twiddles */
+static KF_TARGET void V(bfly)(kiss_fft_cpx * Fout, const size_t fstride, const kiss_fft_cfg st, int m, int p, const kiss_fft_cpx * tw)
+{
+    switch (p) {
+        case 2: V(bfly2)(Fout,tw,m); break;
+        case 3: V(bfly3)(Fout,tw,m,st->twiddles[fstride*m].i); break;
+        case 4: V(bfly4)(Fout,tw,m,st->inverse); break;
+        case 5: V(bfly5)(Fout,tw,m,st->twiddles[fstride*m],st->twiddles[fstride*2*m]); break;
+    }
+}
+
+/* Whole vectors from both ends while [k, k+KF_W) stays below its mirror block
+   (ncfft-k-KF_W, ncfft-k]; returns the k the scalar loop picks up at. */
+static KF_TARGET int V(split)(int ncfft, const kiss_fft_cpx * tmpbuf, const kiss_fft_cpx * super_twiddles, kiss_fft_cpx * freqdata)
+{
+    int k;
+    for (k=1; k + KF_W - 1 < ncfft - k - (KF_W - 1); k+=KF_W) {
+        const int j = ncfft - k - (KF_W - 1);
+        const V(v) fpk = V(load)(tmpbuf+k, KF_W);
+        const V(v) fpnk = V(conj)(V(rev)(V(load)(tmpbuf+j, KF_W)));
+        const V(v) f1k = V(add)(fpk, fpnk);
+        const V(v) tw = V(cmul)(V(sub)(fpk, fpnk), V(load)(super_twiddles+k-1, KF_W));
+        V(store)(freqdata+k, V(scale)(V(add)(f1k, tw), .5f), KF_W);
+        V(store)(freqdata+j, V(rev)(V(conj)(V(scale)(V(sub)(f1k, tw), .5f))), KF_W);
+    }
+    return k;
+}
+
+static KF_TARGET int V(merge)(int ncfft, const kiss_fft_cpx * freqdata, const kiss_fft_cpx * super_twiddles, kiss_fft_cpx * tmpbuf)
+{
+    int k;
+    for (k=1; k + KF_W - 1 < ncfft - k - (KF_W - 1); k+=KF_W) {
+        const int j = ncfft - k - (KF_W - 1);
+        const V(v) fk = V(load)(freqdata+k, KF_W);
+        const V(v) fnkc = V(conj)(V(rev)(V(load)(freqdata+j, KF_W)));
+        const V(v) fek = V(add)(fk, fnkc);
+        const V(v) fok = V(cmul)(V(sub)(fk, fnkc), V(load)(super_twiddles+k-1, KF_W));
+        V(store)(tmpbuf+k, V(add)(fek, fok), KF_W);
+        V(store)(tmpbuf+j, V(rev)(V(conj)(V(sub)(fek, fok))), KF_W);
+    }
+    return k;
+}
@@ -1,4 +1,5 @@
 #define GL_SILENCE_DEPRECATION
+#define GL_GLEXT_PROTOTYPES // buffer objects are past the GL 1.1 that GL/gl.h declares
 
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
@@ -12,6 +13,20 @@
 
 #include "nn.h"
 
+// not in every platform's headers, but the enums are fixed
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B
+#endif
+#ifndef GL_RGB16F
+#define GL_RGB16F 0x881B
+#endif
+#ifndef GL_TEXTURE_SWIZZLE_RGBA
+#define GL_TEXTURE_SWIZZLE_RGBA 0x8E46
+#endif
+
 #define FPS 12
 #define WIDTH 320
 #define HEIGHT 240
@@ -23,24 +38,146 @@ static volatile int frame_count = 0;
 static volatile int lastframe = 0;
 static const int SECONDS = 3;
 static volatile int SHIFT_COLOURS = 0;
-static int framebuffer_id = 0;
+static GLuint framebuffer_id = 0;
+
+/* Frames go up as RGBA8, or as half floats with KALEIDO_TEXTURE=half, converted on the
+ * render thread. The texture is allocated once; each frame is written into the next of
+ * two pixel buffer objects, orphaned first so the driver never has to wait for the
+ * previous upload, and copied over with glTexSubImage2D. SHIFT_COLOURS is a texture
+ * swizzle where the GL has them (3.3, ARB_texture_swizzle), done in the conversion if
+ * not. Without PBOs (before GL 2.1) the upload comes from client memory instead. */
+enum texture_format { TEXTURE_RGBA8, TEXTURE_HALF };
+static int TEXTURE_FORMAT = TEXTURE_RGBA8;
+static int TEXTURE_SWIZZLE = 0;
+static GLuint pixel_buffers[2]; // 0 when there are no PBOs
+static int pixel_buffer = 0;
+static void *staging; // client memory upload when there are no PBOs
+static int swizzled = 0; // the rotation the swizzle is set to
+
+#if COLOURS != 3
+#error "the texture upload packs rgb"
+#endif
+
+static size_t upload_size() {
+  return TEXTURE_FORMAT == TEXTURE_HALF ? WIDTH * HEIGHT * COLOURS * sizeof(uint16_t)
+      : WIDTH * HEIGHT * sizeof(uint32_t);
+}
+
+// [0, 1] rgb floats to rgba bytes, texel channel c taken from colour c - shift
+static void convert_rgba8(uint32_t *out, const float *rgb, int shift) {
+  const int r = (3 - shift) % 3, g = (4 - shift) % 3, b = (5 - shift) % 3;
+  const vfloat scale = v_set1(255.0f), zero = v_set1(0.0f), round = v_set1(12582912.0f);
+  float bytes[COLOURS * VLEN];
+  for (int p = 0; p < WIDTH * HEIGHT; p += VLEN) {
+    for (int k = 0; k < COLOURS; ++k) {
+      vfloat x = v_load(rgb + COLOURS * p + k * VLEN);
+      x = v_min(v_max(v_mul(x, scale), zero), scale);
+      // + 1.5 * 2^23 leaves the rounded byte in the low bits of the mantissa
+      v_store(bytes + k * VLEN, v_add(x, round));
+    }
+    for (int q = 0; q < VLEN; ++q) {
+      uint32_t c[COLOURS];
+      memcpy(c, bytes + COLOURS * q, sizeof(c));
+      out[p + q] = (c[r] & 0xff) | (c[g] & 0xff) << 8 | (c[b] & 0xff) << 16 | 0xff000000u;
+    }
+  }
+}
+
+static void convert_half(uint16_t *out, const float *rgb) {
+  for (int i = 0; i < WIDTH * HEIGHT * COLOURS; i += VLEN) {
+    v_store_half(out + i, v_load(rgb + i));
+  }
+}
+
+// the frame in the current upload format, rotated unless the swizzle does it
+void convert_frame(void *out, const float *rgb, int shift) {
+  if (TEXTURE_FORMAT == TEXTURE_HALF) {
+    convert_half(out, rgb);
+  } else {
+    convert_rgba8(out, rgb, TEXTURE_SWIZZLE ? 0 : shift);
+  }
+}
+
+static int has_extension(const char *name) {
+  const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+  return extensions && strstr(extensions, name);
+}
+
+retcode create_framebuffer() {
+  int major = 0, minor = 0;
+  sscanf((const char *) glGetString(GL_VERSION), "%d.%d", &major, &minor);
+  const int version = major * 10 + minor;
+  TEXTURE_SWIZZLE = version >= 33 || has_extension("GL_ARB_texture_swizzle") ||
+      has_extension("GL_EXT_texture_swizzle");
+  if (TEXTURE_FORMAT == TEXTURE_HALF && (version < 30 || !TEXTURE_SWIZZLE)) {
+    TEXTURE_FORMAT = TEXTURE_RGBA8;
+  }
 
-void create_framebuffer() {
   glGenTextures(1, &framebuffer_id);
   glBindTexture(GL_TEXTURE_2D, framebuffer_id);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+  if (TEXTURE_FORMAT == TEXTURE_HALF) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, WIDTH, HEIGHT, 0, GL_RGB, GL_HALF_FLOAT, NULL);
+  } else {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, WIDTH, HEIGHT, 0, GL_RGBA,
+        GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+  }
+
+  if (version >= 21 || has_extension("GL_ARB_pixel_buffer_object")) {
+    glGenBuffers(2, pixel_buffers);
+    for (int b = 0; b < 2; ++b) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffers[b]);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, upload_size(), NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  } else {
+    staging = malloc(upload_size());
+    retfail(-(staging == NULL));
+  }
+  retfail(-(glGetError() != GL_NO_ERROR));
+  return SUCCESS;
 }
 
-void render_buffer(float *buffer) {
-  if(COLOURS == 1) {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, 
-      WIDTH, HEIGHT, 0, GL_LUMINANCE, GL_FLOAT, buffer);
-  } else if (COLOURS == 3) {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH, HEIGHT, 0, GL_RGB,
-               GL_FLOAT, buffer - SHIFT_COLOURS * sizeof(float));
+// buffer into the texture, without drawing anything
+void upload_frame(const float *buffer) {
+  const int shift = SHIFT_COLOURS;
+  void *pixels = staging;
+  if (pixel_buffers[0]) {
+    pixel_buffer ^= 1;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffers[pixel_buffer]);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, upload_size(), NULL, GL_STREAM_DRAW);
+    pixels = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (pixels == NULL) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return; // keep showing the last frame
+    }
+  }
+  convert_frame(pixels, buffer, shift);
+  if (pixel_buffers[0]) {
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    pixels = NULL; // now an offset into the bound buffer
+  }
+  if (TEXTURE_FORMAT == TEXTURE_HALF) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WIDTH, HEIGHT, GL_RGB, GL_HALF_FLOAT, pixels);
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WIDTH, HEIGHT, GL_RGBA,
+        GL_UNSIGNED_INT_8_8_8_8_REV, pixels);
+  }
+  if (pixel_buffers[0]) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
   }
+  if (TEXTURE_SWIZZLE && shift != swizzled) {
+    const GLint rotated[] = { GL_BLUE, GL_RED, GL_GREEN, GL_ALPHA };
+    const GLint identity[] = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, shift ? rotated : identity);
+    swizzled = shift;
+  }
+}
+
+void render_buffer(float *buffer) {
+  upload_frame(buffer);
   //glPolygonMode(GL_FRONT_AND_BACK, self->polygon_mode);
   
   glBegin(GL_QUADS);
@@ -86,7 +223,7 @@ int init_display(int argc, char **argv) {
   glPopMatrix();
   glMatrixMode(GL_MODELVIEW);
 
-  create_framebuffer();
+  retfail(create_framebuffer());
 
   return SUCCESS;
 }
@@ -0,0 +1,486 @@
+/* Per-stage microbenchmarks of the frame pipeline on a fixed seed, with accuracy
+ * checks against straightforward double precision references.
+ *   bin/kaleido_bench [ITERATIONS] [--gl]
+ * --gl opens a window to time render_buffer() too. KALEIDO_SEED overrides the seed,
+ * KALEIDO_TEXTURE=half converts to half floats. */
+#define KALEIDO_BENCH
+#include "kaleidosynth.c"
+
+static const double CPPN_FLOPS = 2.0 * (INPUT_DIM * 20 + 20 * 20 + 20 * COLOURS) * WIDTH * HEIGHT;
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// real fft of n points, the usual 5/2 n log2 n
+static double fftr_flops(int n) {
+    return 2.5 * n * log2(n);
+}
+
+// complex fft of n points, 5 n log2 n
+static double fft_flops(int n) {
+    return 5.0 * n * log2(n);
+}
+
+// a bank of Goertzel filters over n samples: s = x + c s1 - s2 is 3 per sample each
+static double goertzel_flops(int filters, int n) {
+    return 3.0 * filters * n;
+}
+
+/// STAGES ///
+float *bench_frame; // a rendered frame, what every stage below starts from
+float *bench_scratch; // FRAME_BATCH frames of work space
+// the complex transform under kiss_fftr full, through the plain recursion and four step
+#define BENCH_FFT (AUDIO_BAND / 2)
+kiss_fft_cfg plain_cfg, fourstep_cfg;
+
+struct stage {
+    const char *name;
+    void (*prepare)(void); // untimed, before every run
+    void (*run)(void);
+    double flops, bytes; // per run, 0 if it doesn't mean anything
+};
+
+static void reset_scratch() {
+    memcpy(bench_scratch, bench_frame, AUDIO_BAND * sizeof(float));
+}
+
+static void run_feedforward() {
+    const float t = 0.25;
+    matrix output = { .x = nn_batch_size, .y = COLOURS, .e = bench_scratch };
+    render_network(&networks[0], &t, output, 1);
+}
+
+static void run_feedforward_batch() {
+    float t[FRAME_BATCH];
+    for(int f=0; f < FRAME_BATCH; ++f) {
+        t[f] = 0.25 + f * 0.01;
+    }
+    matrix output = { .x = FRAME_BATCH * nn_batch_size, .y = COLOURS, .e = bench_scratch };
+    render_network(&networks[0], t, output, FRAME_BATCH);
+}
+
+static void run_fftr() {
+    kiss_fftr(full_fftr_cfg, bench_scratch, (kiss_fft_cpx *) frequency_space);
+}
+
+static void run_fftri() {
+    kiss_fftri(full_fftri_cfg, (kiss_fft_cpx *) frequency_space, bench_scratch);
+}
+
+static void run_fft_plain() {
+    kiss_fft(plain_cfg, (kiss_fft_cpx *) bench_frame, (kiss_fft_cpx *) bench_scratch);
+}
+
+static void run_fft_fourstep() {
+    kiss_fft(fourstep_cfg, (kiss_fft_cpx *) bench_frame, (kiss_fft_cpx *) bench_scratch);
+}
+
+static void run_piano() {
+    piano_filter(bench_scratch, 0);
+}
+
+static void run_melody() {
+    melody_filter(bench_scratch);
+}
+
+static void run_beats() {
+    add_beats(bench_scratch, &beats_rng);
+}
+
+static void run_reverse_odd_rows() {
+    reverse_odd_rows(bench_scratch, bench_frame);
+}
+
+// a second of audio in 64 frame callbacks, a typical low latency buffer
+static void run_audio_callback() {
+    float out[2 * 64];
+    for(int i=0; i < 44100 / 64; ++i) {
+        audio_callback(NULL, out, 64, NULL, 0, &audio_buf);
+    }
+}
+
+static void run_convert_frame() {
+    convert_frame(bench_scratch, bench_frame, 1);
+}
+
+static void run_render_buffer() {
+    render_buffer(bench_frame);
+}
+
+static void bench(const struct stage *stage, int iterations) {
+    double times[iterations];
+    for(int i=0; i < iterations; ++i) {
+        if(stage->prepare) {
+            stage->prepare();
+        }
+        const double start = now();
+        stage->run();
+        times[i] = now() - start;
+    }
+    qsort(times, iterations, sizeof(double), compare_doubles);
+    const double min = times[0], median = times[iterations / 2];
+    const double p99 = times[(int) ceil(0.99 * iterations) - 1];
+    printf("%-18s %9.3f %9.3f %9.3f", stage->name, min * 1e3, median * 1e3, p99 * 1e3);
+    if(stage->flops > 0) {
+        printf(" %8.2f GFLOP/s", stage->flops / median * 1e-9);
+    }
+    if(stage->bytes > 0) {
+        printf(" %8.2f GB/s", stage->bytes / median * 1e-9);
+    }
+    printf("\n");
+}
+
+/// ACCURACY ///
+static double reference_gaussian(double z) {
+    return exp(-z * z);
+}
+
+// the cppn at raster index p and time t, in doubles straight from the weights
+static void reference_pixel(const struct cppn_network *net, int p, double t, double out[]) {
+    const int i = p / WIDTH, j = p % WIDTH;
+    double in[SMALL_GEMM_MAX] = { coordinate(j, WIDTH), coordinate(i, HEIGHT), t };
+    double next[SMALL_GEMM_MAX];
+    int width = INPUT_DIM;
+    for(int l=0; l < CPPN_LAYERS; ++l) {
+        const matrix w = net->layer[l].weights;
+        for(size_t k=0; k < w.y; ++k) {
+            double z = net->layer[l].bias[k];
+            for(int m=0; m < width; ++m) {
+                z += in[m] * w.e[m * w.y + k];
+            }
+            next[k] = reference_gaussian(z);
+        }
+        width = w.y;
+        memcpy(in, next, sizeof(in));
+    }
+    memcpy(out, in, COLOURS * sizeof(double));
+}
+
+static double check_feedforward(int precision) {
+    const int mode = ACTIVATION_PRECISION;
+    ACTIVATION_PRECISION = precision;
+    run_feedforward();
+    ACTIVATION_PRECISION = mode;
+    double err = 0;
+    for(int p=0; p < WIDTH*HEIGHT; p += 97) {
+        double ref[COLOURS];
+        reference_pixel(&networks[0], p, 0.25, ref);
+        for(int c=0; c < COLOURS; ++c) {
+            err = fmax(err, fabs(ref[c] - bench_scratch[p * COLOURS + c]));
+        }
+    }
+    return err;
+}
+
+// v_exp against exp over the range the gaussians see, relative
+static double check_exp(int exact) {
+    float in[VLEN], out[VLEN];
+    double err = 0;
+    for(double x=-80; x < 0; x += VLEN * 1e-3) {
+        for(int i=0; i < VLEN; ++i) {
+            in[i] = x + i * 1e-3;
+        }
+        v_store(out, v_exp(v_load(in), exact));
+        for(int i=0; i < VLEN; ++i) {
+            err = fmax(err, fabs(out[i] / exp(in[i]) - 1));
+        }
+    }
+    return err;
+}
+
+// tanh_activate_rows and relu_activate_rows against libm over [-10, 10], 0 included, with
+// a bias row so both the tiled and the leftover paths run; absolute, and relative to
+// |tanh| near zero
+static double check_activation(enum activation_kind kind, int precision) {
+    enum { COLS = 20, ROWS = 1001 }; // a leftover row when VLEN doesn't divide it
+    static float z[ROWS * COLS], out[ROWS * COLS];
+    float bias[COLS];
+    for(int c=0; c < COLS; ++c) {
+        bias[c] = c % 2 ? 0.0f : 1e-3f * c; // 0 itself in every odd column
+    }
+    for(int i=0; i < ROWS * COLS; ++i) {
+        z[i] = -10.0f + 20.0f * (i / COLS) / (ROWS - 1);
+    }
+    const int mode = ACTIVATION_PRECISION;
+    ACTIVATION_PRECISION = precision;
+    (kind == TANH ? tanh_activate_rows : relu_activate_rows)(out, z, bias, ROWS, COLS);
+    ACTIVATION_PRECISION = mode;
+    double err = 0;
+    for(int i=0; i < ROWS * COLS; ++i) {
+        const float x = z[i] + bias[i % COLS];
+        const double want = kind == TANH ? tanhf(x) : fmaxf(x, 0);
+        const double diff = fabs(out[i] - want);
+        err = fmax(err, kind == TANH && fabs(want) < 0.5 ? diff / fmax(fabs(want), 1e-6) : diff);
+    }
+    return err;
+}
+
+// bins of kiss_fftr against a direct dft, relative to the input's norm
+static double check_fftr(kiss_fftr_cfg cfg, int n, const float *in) {
+    float out[n + 2];
+    kiss_fftr(cfg, in, (kiss_fft_cpx *) out);
+    double norm = 0;
+    for(int i=0; i < n; ++i) {
+        norm += (double) in[i] * in[i];
+    }
+    double err = 0;
+    const int bins[] = { 0, 1, 2, 3, 7, 100, n / 3, n / 2 - 1, n / 2 };
+    for(size_t b=0; b < sizeof(bins) / sizeof(bins[0]); ++b) {
+        double re = 0, im = 0;
+        for(int i=0; i < n; ++i) {
+            const double angle = -2 * M_PI * ((long) bins[b] * i % n) / n;
+            re += in[i] * cos(angle);
+            im += in[i] * sin(angle);
+        }
+        err = fmax(err, hypot(re - out[2 * bins[b]], im - out[2 * bins[b] + 1]));
+    }
+    return err / sqrt(norm * n);
+}
+
+// four step against the plain recursion, both ways, relative to the largest bin
+static double check_fourstep() {
+    static kiss_fft_cpx plain[BENCH_FFT], fourstep[BENCH_FFT];
+    const kiss_fft_cpx *in = (const kiss_fft_cpx *) bench_frame;
+    double err = 0;
+    for(int inverse=0; inverse < 2; ++inverse) {
+        kiss_fft_cfg a = kiss_fft_alloc(BENCH_FFT, inverse, NULL, NULL);
+        kiss_fft_cfg b = kiss_fft_alloc_fourstep(BENCH_FFT, inverse, NULL, NULL);
+        kiss_fft(a, in, plain);
+        kiss_fft(b, in, fourstep);
+        double diff = 0, norm = 0;
+        for(int k=0; k < BENCH_FFT; ++k) {
+            diff = fmax(diff, hypot(plain[k].r - fourstep[k].r, plain[k].i - fourstep[k].i));
+            norm = fmax(norm, hypot(plain[k].r, plain[k].i));
+        }
+        err = fmax(err, diff / norm);
+        kiss_fft_free(a);
+        kiss_fft_free(b);
+    }
+    return err;
+}
+
+// sizes with a prime factor for Bluestein, alone and under radix 3 and 4 stages that
+// OpenMP splits over threads, against a long double dft on 64 of their bins
+static double check_primes() {
+    const int primes[] = { 59, 61, 67, 9601, 65537, 100003, 3 * 9601, 4 * 9601 };
+    const kiss_fft_cpx *in = (const kiss_fft_cpx *) bench_frame;
+    double err = 0;
+    for(size_t p=0; p < sizeof(primes) / sizeof(primes[0]); ++p) {
+        const int n = primes[p];
+        kiss_fft_cfg cfg = kiss_fft_alloc(n, 0, NULL, NULL);
+        kiss_fft_cpx *out = malloc(n * sizeof(kiss_fft_cpx));
+        kiss_fft(cfg, in, out);
+        double norm = 0;
+        for(int j=0; j < n; ++j) {
+            norm += (double) in[j].r * in[j].r + (double) in[j].i * in[j].i;
+        }
+        for(int b=0; b < 64; ++b) {
+            const long k = ((long) b * n / 64 + b % 3) % n; // spread out, off the even split
+            long double re = 0, im = 0;
+            for(int j=0; j < n; ++j) {
+                const long double angle = -2 * M_PI * (k * j % n) / n;
+                re += in[j].r * cosl(angle) - in[j].i * sinl(angle);
+                im += in[j].r * sinl(angle) + in[j].i * cosl(angle);
+            }
+            err = fmax(err, hypot(re - out[k].r, im - out[k].i) / sqrt(norm * n));
+        }
+        free(out);
+        kiss_fft_free(cfg);
+    }
+    return err;
+}
+
+// kiss_fftri(kiss_fftr(x)) / n against x
+static double check_roundtrip(kiss_fftr_cfg forward, kiss_fftr_cfg inverse, int n,
+        const float *in) {
+    float freq[n + 2], back[n];
+    kiss_fftr(forward, in, (kiss_fft_cpx *) freq);
+    kiss_fftri(inverse, (kiss_fft_cpx *) freq, back);
+    double err = 0, norm = 0;
+    for(int i=0; i < n; ++i) {
+        err = fmax(err, fabs(back[i] / n - in[i]));
+        norm = fmax(norm, fabs(in[i]));
+    }
+    return err / norm;
+}
+
+// kiss_fftr_bins and kiss_fftri_bins against the full transforms, on every 97th bin
+static double check_pruned() {
+    static float full[AUDIO_BAND + 2], pruned[AUDIO_BAND + 2], back[AUDIO_BAND];
+    int bins[100], count = 0;
+    for(int b=0; b <= AUDIO_BAND / 2 && count < 100; b += 97) {
+        bins[count++] = b;
+    }
+    kiss_fftr(full_fftr_cfg, bench_frame, (kiss_fft_cpx *) full);
+    kiss_fftr_bins(full_fftr_cfg, bench_frame, (kiss_fft_cpx *) pruned, bins, count);
+    double err = 0, norm = 0;
+    for(int c=0; c < count; ++c) {
+        const int b = bins[c];
+        err = fmax(err, hypot(full[2 * b] - pruned[2 * b], full[2 * b + 1] - pruned[2 * b + 1]));
+        norm = fmax(norm, hypot(full[2 * b], full[2 * b + 1]));
+    }
+    memset(full, 0, sizeof(full)); // the spectrum kiss_fftri_bins sees
+    for(int c=0; c < count; ++c) {
+        full[2 * bins[c]] = pruned[2 * bins[c]];
+        full[2 * bins[c] + 1] = pruned[2 * bins[c] + 1];
+    }
+    kiss_fftri(full_fftri_cfg, (kiss_fft_cpx *) full, bench_scratch);
+    kiss_fftri_bins(full_fftri_cfg, (kiss_fft_cpx *) pruned, bins, count, back);
+    double err_inverse = 0, norm_inverse = 0;
+    for(int i=0; i < AUDIO_BAND; ++i) {
+        err_inverse = fmax(err_inverse, fabs(back[i] - bench_scratch[i]));
+        norm_inverse = fmax(norm_inverse, fabs(bench_scratch[i]));
+    }
+    return fmax(err / norm, err_inverse / norm_inverse);
+}
+
+// the rgba8 conversion against to_byte, rotated as the display does; off by one is rounding
+static int check_convert_rgba8() {
+    convert_rgba8((uint32_t *) bench_scratch, bench_frame, 1);
+    const uint8_t *bytes = (const uint8_t *) bench_scratch;
+    int worst = 0;
+    for(int p=0; p < WIDTH*HEIGHT; ++p) {
+        for(int c=0; c < COLOURS; ++c) {
+            const int want = to_byte(bench_frame[p * COLOURS + (c + COLOURS - 1) % COLOURS]);
+            worst = fmax(worst, abs(bytes[4 * p + c] - want));
+        }
+        worst = fmax(worst, abs(bytes[4 * p + 3] - 255));
+    }
+    return worst;
+}
+
+// snake order against the raster frame, pixel by pixel
+static int check_reverse_odd_rows() {
+    reverse_odd_rows(bench_scratch, bench_frame);
+    int wrong = 0;
+    for(int i=0; i < HEIGHT; ++i) {
+        for(int j=0; j < WIDTH; ++j) {
+            const int snake = i * WIDTH + (i % 2 == 0 ? j : WIDTH - 1 - j);
+            wrong += memcmp(bench_scratch + snake * COLOURS,
+                    bench_frame + pixel_index(i, j) * COLOURS, COLOURS * sizeof(float)) != 0;
+        }
+    }
+    return wrong;
+}
+
+// the frame queue driven without threads, the display skipping ticks so frames get dropped
+// and missed and now and then a reseed: slots the producer is handed that display() holds
+// or that are still queued
+static int check_frame_queue() {
+    struct rng rng;
+    rng_seed(&rng, SEED, 2);
+    queue.frames = calloc(FRAME_QUEUE * AUDIO_BAND, sizeof(float));
+    const int start = frame_count;
+    int clobbered = 0;
+    for(int step=0; step < 100000; ++step) {
+        const uint32_t action = rng_below(&rng, 16);
+        if(action < 8) { // the producer renders a batch
+            int tail;
+            const int space = queue_space(&tail);
+            if(space == 0) {
+                continue;
+            }
+            const int frames = 1 + rng_below(&rng, space);
+            for(int f=0; f < frames; ++f) {
+                const int slot = (tail + f) % FRAME_QUEUE;
+                clobbered += slot == queue.held ||
+                    (slot - queue.head + FRAME_QUEUE) % FRAME_QUEUE < queue.count;
+            }
+            const int tick = queue.next_tick > frame_count ? queue.next_tick : frame_count;
+            queue_publish(tail, frames, tick, 0);
+        } else if(action < 15) { // display() comes round, sometimes a few ticks late
+            frame_count += rng_below(&rng, 4);
+            next_frame(frame_count, 0);
+        } else {
+            request_reseed();
+        }
+    }
+    free(queue.frames);
+    queue = (struct frame_queue) { .held = -1 };
+    RESEED = 0;
+    frame_count = start;
+    return clobbered;
+}
+
+int main(int argc, char **argv) {
+    int iterations = 50, gl = 0;
+    for(int a=1; a < argc; ++a) {
+        if(strcmp(argv[a], "--gl") == 0) {
+            gl = 1;
+        } else {
+            iterations = atoi(argv[a]) > 0 ? atoi(argv[a]) : iterations;
+        }
+    }
+    const char *seed = getenv("KALEIDO_SEED");
+    SEED = seed ? strtoull(seed, NULL, 0) : 1;
+    printf("kaleido_bench, KALEIDO_SEED=%llu, %d iterations\n", (unsigned long long) SEED,
+            iterations);
+    retfail(init_pipeline());
+    const char *texture = getenv("KALEIDO_TEXTURE");
+    TEXTURE_FORMAT = texture && strcmp(texture, "half") == 0 ? TEXTURE_HALF : TEXTURE_RGBA8;
+    if(gl) {
+        retfail(init_display(argc, argv));
+    }
+    bench_frame = malloc(AUDIO_BAND * sizeof(float));
+    bench_scratch = malloc(FRAME_BATCH * AUDIO_BAND * sizeof(float));
+    plain_cfg = kiss_fft_alloc(BENCH_FFT, 0, NULL, NULL);
+    fourstep_cfg = kiss_fft_alloc_fourstep(BENCH_FFT, 0, NULL, NULL);
+    run_feedforward();
+    memcpy(bench_frame, bench_scratch, AUDIO_BAND * sizeof(float));
+    publish_audio(bench_frame);
+
+    const double frame_bytes = AUDIO_BAND * sizeof(float);
+    const struct stage stages[] = {
+        { "feedforward", NULL, run_feedforward, CPPN_FLOPS, 0 },
+        { "feedforward x3", NULL, run_feedforward_batch, FRAME_BATCH * CPPN_FLOPS, 0 },
+        { "kiss_fftr full", reset_scratch, run_fftr, fftr_flops(AUDIO_BAND), 0 },
+        { "kiss_fftri full", NULL, run_fftri, fftr_flops(AUDIO_BAND), 0 },
+        { "kiss_fft plain", NULL, run_fft_plain, fft_flops(BENCH_FFT), 0 },
+        { "kiss_fft fourstep", NULL, run_fft_fourstep, fft_flops(BENCH_FFT), 0 },
+        { "piano", reset_scratch, run_piano, 2 * fftr_flops(AUDIO_BAND), 0 },
+        // the bank over each signal, and its mean and the mix at 5 per sample
+        { "melody", reset_scratch, run_melody,
+            MELODY_SIGNALS * (goertzel_flops(melody.lanes, BAR_LENGTH) + 5.0 * BAR_LENGTH), 0 },
+        { "beats", reset_scratch, run_beats, fftr_flops(BAR_LENGTH), frame_bytes * 2 },
+        { "reverse_odd_rows", NULL, run_reverse_odd_rows, 0, frame_bytes * 2 },
+        { "audio 1s/64", NULL, run_audio_callback, 0, 44100 / 64 * 64 * 4 * sizeof(float) },
+        { "convert_frame", NULL, run_convert_frame, 0, frame_bytes + upload_size() },
+        { "render_buffer", NULL, run_render_buffer, 0, frame_bytes },
+    };
+    const int count = sizeof(stages) / sizeof(stages[0]) - !gl;
+    printf("%-18s %9s %9s %9s  (ms)\n", "stage", "min", "median", "p99");
+    for(int s=0; s < count; ++s) {
+        bench(&stages[s], iterations);
+    }
+
+    printf("\naccuracy\n");
+    printf("v_exp fast          rel err %.3g\n", check_exp(0));
+    printf("v_exp exact         rel err %.3g\n", check_exp(1));
+    printf("tanh fast           max err %.3g\n", check_activation(TANH, ACTIVATE_FAST));
+    printf("tanh exact          max err %.3g\n", check_activation(TANH, ACTIVATE_EXACT));
+    printf("relu fast           max abs err %.3g\n", check_activation(RELU, ACTIVATE_FAST));
+    printf("relu exact          max abs err %.3g\n", check_activation(RELU, ACTIVATE_EXACT));
+    printf("feedforward fast    max abs err %.3g\n", check_feedforward(ACTIVATE_FAST));
+    printf("feedforward exact   max abs err %.3g\n", check_feedforward(ACTIVATE_EXACT));
+    printf("kiss_fftr full      rel err %.3g\n", check_fftr(full_fftr_cfg, AUDIO_BAND, bench_frame));
+    printf("kiss_fftr bar       rel err %.3g\n", check_fftr(bar_fftr_cfg, BAR_LENGTH, bench_frame));
+    printf("roundtrip full      rel err %.3g\n",
+            check_roundtrip(full_fftr_cfg, full_fftri_cfg, AUDIO_BAND, bench_frame));
+    printf("roundtrip bar       rel err %.3g\n",
+            check_roundtrip(bar_fftr_cfg, bar_fftri_cfg, BAR_LENGTH, bench_frame));
+    printf("fourstep full       rel err %.3g\n", check_fourstep());
+    printf("bluestein primes    rel err %.3g\n", check_primes());
+    printf("pruned full         rel err %.3g\n", check_pruned());
+    printf("reverse_odd_rows    wrong pixels %d\n", check_reverse_odd_rows());
+    printf("convert rgba8       max byte err %d\n", check_convert_rgba8());
+    printf("frame queue         clobbered slots %d\n", check_frame_queue());
+    return SUCCESS;
+}
@@ -3,15 +3,23 @@
 #include <portaudio.h>
 #include <complex.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include "kiss_fftr.h"
 #include "err.h"
 #include "nn.h"
 #include "gl.h"
+#include "media.h"
+#include "resample.h"
+#include "timing.h"
 #include <time.h>
 #include <limits.h>
 #include <assert.h>
 
-float framebuffer_unsnake[HEIGHT][WIDTH][COLOURS];
+// Frames are rendered in raster order and drawn straight from the queue. The audio is
+// the same samples read in snake (boustrophedon) order, odd rows right to left: the
+// callback reads rows backwards and the effects work on a snake ordered copy.
+float snake_frame[HEIGHT][WIDTH][COLOURS]; // effects scratch
+float *shown_frame = NULL; // what display() last drew, still held in the queue
 /// AUDIO GLOBALS ///  
 static const float gaussian_kernel[] = 
 { 0.006, 0.06136, 0.24477, 0.38774, 0.24477, 0.06136, 0.006};
@@ -27,22 +35,56 @@ typedef struct {
     int left_phase;
     int right_phase;
     int colourphase;
+    int front; // the audio_buffers[] being played
+    int primed; // front has had a frame in it, silence until then
+    int resampling; // the device runs at another rate, go through resampler
+    struct resampler resampler;
     kiss_fftr_cfg cfg;
 } LRAudioBuf;
-LRAudioBuf audio_buf = { 0 };
+LRAudioBuf audio_buf = { .front = 0 };
 PaStream *stream = NULL;
 static const float volumeMultiplier = 1.0f; //0.01f;
-static const float SAMPLE_RATE = 44100;
-static const float BANDPASS = 15000. / (SAMPLE_RATE / (float) AUDIO_BAND);
+// The rate frames are played back at, which the harmonics and tempo are built around.
+// KALEIDO_RATE=<hz> picks another, KALEIDO_RATE=native follows the output device. The
+// stream always opens at the device's own rate and resamples from this one if they differ.
+static float SAMPLE_RATE = 44100;
+#ifndef KALEIDO_BENCH
+static int NATIVE_RATE = 0;
+#endif
+static float BANDPASS = 0; // bins above 15kHz, set with the harmonics
 
-static volatile clock_t lasttime = 0;
+static volatile uint64_t lasttime = 0; // monotonic ns
 const float freqs[] = // key of A
         // A    B       C#      D       E       F#      G#
     { 440, 493.88, 554.37, 587.33, 659.25, 739.99, 830.61 };
 #define NUM_KEYS 7
-float harmonics[NUM_KEYS][AUDIO_BAND];
-float frequency_space[AUDIO_BAND];
-float audio_double_buf[WIDTH*HEIGHT][COLOURS];
+// A key's harmonics are a few octaves of a short kernel, so rather than a dense spectrum
+// sized table each key keeps runs of consecutive spectrum entries, every entry outside
+// them 0. Entries index the interleaved re/im floats of frequency_space, as always.
+#define MAX_OCTAVES 32 // a run per octave at most, never near that for AUDIO_BAND < 2^32
+#define MAX_HARMONIC_WEIGHTS (MAX_OCTAVES * 7) // a kernel's width per octave
+struct harmonic_run {
+    int start, length;
+    const float *weights; // length of them, into the mask's weights
+};
+struct harmonic_mask {
+    int runs; // ascending and apart
+    struct harmonic_run run[MAX_OCTAVES];
+    float weights[MAX_HARMONIC_WEIGHTS];
+    int octaves; // the impulses the kernel was convolved over
+    int position[MAX_OCTAVES];
+    float weight[MAX_OCTAVES];
+};
+struct harmonic_mask harmonics[NUM_KEYS];
+float frequency_space[AUDIO_BAND + 2]; // AUDIO_BAND/2 + 1 complex bins
+// Triple buffer between the render side and the audio callback. Each side owns one buffer
+// outright and they trade through audio_shared with a single atomic exchange, so the
+// callback never locks and never reads what is being written. The callback only trades
+// at the left_phase wrap, so every buffer plays out whole.
+#define AUDIO_FRESH 4 // set in audio_shared when it holds a buffer the callback hasn't had
+float audio_buffers[3][WIDTH*HEIGHT][COLOURS];
+static _Atomic int audio_shared = 1;
+static int audio_back = 2; // render side
 kiss_fftr_cfg full_fftri_cfg = {0};
 kiss_fftr_cfg full_fftr_cfg = {0};
 kiss_fftr_cfg bar_fftri_cfg = {0};
@@ -51,135 +93,578 @@ kiss_fftr_cfg bar_fftr_cfg = {0};
 /// NEURAL NETWORK GLOBALS ///
 static const int nn_input_size = INPUT_DIM; // x, y, frame
 static const int nn_batch_size = WIDTH * HEIGHT;
+#define FRAME_BATCH 3 // frames stacked into one inference pass
 static const int hidden_neurons = 20, output_neurons = COLOURS;
 static const int epochs = 10;
-static const int num_layers = 4; // THIS MUST MATCH BELOW
-static const int last_layer = num_layers -1;
+static const int num_layers = 4; // input plus the cppn[] below, THIS MUST MATCH
 static const float initialization_sigma = 8.0 / num_layers;
-struct neural_layer cppn[] = {
-    {
-        .activations = { .x = nn_batch_size, .y = nn_input_size, .e = NULL },
-        .zvals = { .x = nn_batch_size, .y = nn_input_size, .e = NULL },
-    }, {
-        .activate = &gaussian_activate,
-        .backprop = &gaussian_prime,
-    }, {
-        .activate = &gaussian_activate,
-        .backprop = &gaussian_prime,
-    }, {
-        .activate = &gaussian_activate,
-        .backprop = &gaussian_prime,
-    },
+uint64_t SEED = 0; // everything random derives from this, KALEIDO_SEED to replay a run
+struct rng beats_rng; // display() only
+#define CPPN_LAYERS 3
+// the architecture, every cppn_network below gets its own weights for these
+const struct inference_layer cppn[CPPN_LAYERS] = {
+    { .activate = &gaussian_activate_rows }, // x, y, t -> hidden
+    { .activate = &gaussian_activate_rows },
+    { .activate = &gaussian_activate_rows }, // hidden -> colours
 };
+// the input is never materialized, cppn_first_layer builds layer 0 from the coordinates
+matrix nn_input = { .x = nn_batch_size, .y = nn_input_size, .e = NULL };
+matrix nn_output = { .x = nn_batch_size, .y = output_neurons, .e = NULL };
+struct thread_pool nn_pool;
+struct thread_pool effects_pool; // display()'s, nn_pool is the frame producer's
 
-static int seed_network() {
-    for (int i = 1; i < num_layers; ++i) {
-        randomize(cppn[i].weights.e, 
-                cppn[i].weights.x * cppn[i].weights.y, 
-                initialization_sigma);
-        randomize(cppn[i].biases.e, 
-                cppn[i].biases.x * cppn[i].biases.y, 
-                initialization_sigma);
+// The first layer only ever sees (x, y, t) and x, y never change, so keep x * w_x per
+// column and y * w_y per row from the seed. A frame then only adds t * w_t once per row
+// (a rank-1 update) and there is no input matrix at all.
+struct cppn_network {
+    struct inference_layer layer[CPPN_LAYERS];
+    float *x_term; // [WIDTH][hidden_neurons]
+    float *y_term; // [HEIGHT][hidden_neurons]
+    int origin; // tick at which this network's t starts from -1
+};
+float *cppn_row_term = NULL; // [FRAME_BATCH][HEIGHT][hidden_neurons], y plus each frame's t
+
+static float coordinate(int index, int extent) {
+    return (float) index / (extent/2) -1.0;
+}
+
+static void cache_coordinates(struct cppn_network *net) {
+    const float (*w)[hidden_neurons] = (void *) net->layer[0].weights.e; // rows: x, y, t
+    for(int j=0; j < WIDTH; ++j) {
+        for(int k=0; k < hidden_neurons; ++k) {
+            net->x_term[j * hidden_neurons + k] = coordinate(j, WIDTH) * w[0][k];
+        }
+    }
+    for(int i=0; i < HEIGHT; ++i) {
+        for(int k=0; k < hidden_neurons; ++k) {
+            net->y_term[i * hidden_neurons + k] = coordinate(i, HEIGHT) * w[1][k];
+        }
     }
 }
 
-static int init_neural_network() {
-    for (int i = 0; i < num_layers; ++i) {
-        if(i == 0) {
-            cppn[i].activations.e = malloc(nn_batch_size * nn_input_size * 
-                    sizeof(float));
-            cppn[i].zvals.e = malloc(nn_batch_size * nn_input_size * 
-                    sizeof(float));
-        } else {
-            cppn[i].weights.x = cppn[i].w_delt.x = cppn[i-1].activations.y;
-            cppn[i].biases.x = cppn[i].b_delt.x = cppn[i].activations.x =
-                cppn[i].zvals.x = nn_batch_size;
-            if(i == last_layer) {
-                cppn[i].weights.y = cppn[i].w_delt.y = cppn[i].biases.y = cppn[i].b_delt.y = 
-                    cppn[i].activations.y = cppn[i].zvals.y = output_neurons;
-            } else {
-                cppn[i].weights.y = cppn[i].w_delt.y = cppn[i].biases.y = cppn[i].b_delt.y = 
-                    cppn[i].activations.y = cppn[i].zvals.y = hidden_neurons;
+// row terms for a batch of frames at times t[0..frames)
+static void set_frame_times(const struct cppn_network *net, const float *t, int frames) {
+    const float (*w)[hidden_neurons] = (void *) net->layer[0].weights.e;
+    for(int f=0; f < frames; ++f) {
+        float *row_term = cppn_row_term + f * HEIGHT * hidden_neurons;
+        for(int i=0; i < HEIGHT; ++i) {
+            for(int k=0; k < hidden_neurons; ++k) {
+                row_term[i * hidden_neurons + k] = 
+                    net->y_term[i * hidden_neurons + k] + t[f] * w[2][k];
             }
+        }
+    }
+}
 
-            cppn[i].weights.e = malloc(cppn[i].weights.x * cppn[i].weights.y * 
-                    sizeof(float));
-            cppn[i].w_delt.e = calloc(cppn[i].w_delt.x * cppn[i].w_delt.y, 
-                    sizeof(float));
+// A batch stacks frames along the rows: row r is point r % points of frame r / points.
+// pixels is NULL for whole frames, or the raster indices being evaluated (see the
+// kaleidoscope below).
+struct cppn_batch {
+    const struct cppn_network *net;
+    const uint32_t *pixels;
+    size_t points;
+};
+static void cppn_first_layer(void *context, float *zvals, size_t row, size_t rows, size_t cols) {
+    const struct cppn_batch *batch = context;
+    for(size_t r = row; r < row + rows; ++r) {
+        const size_t f = r / batch->points, point = r % batch->points;
+        const size_t p = batch->pixels ? batch->pixels[point] : point;
+        const size_t i = p / WIDTH, j = p % WIDTH;
+        const float *x_term = batch->net->x_term + j * cols;
+        const float *row_term = cppn_row_term + (f * HEIGHT + i) * cols;
+        float *z = zvals + (r - row) * cols;
+        for(size_t k=0; k < cols; ++k) {
+            z[k] = x_term[k] + row_term[k];
+        }
+    }
+}
 
-            cppn[i].biases.e = malloc(cppn[i].biases.x * cppn[i].biases.y * 
-                    sizeof(float));
-            cppn[i].b_delt.e = calloc(cppn[i].b_delt.x * cppn[i].b_delt.y, 
-                    sizeof(float));
-            cppn[i].activations.e = calloc(
-                    cppn[i].activations.x * cppn[i].activations.y, 
-                    sizeof(float));
-            cppn[i].zvals.e = calloc(cppn[i].zvals.x * cppn[i].zvals.y, 
-                    sizeof(float));
+/// KALEIDOSCOPE ///
+// Fold every pixel into one fundamental wedge around the centre, run the cppn only on
+// the wedge's pixels and copy the results back out, so inference shrinks by the order.
+enum symmetry { SYMMETRY_NONE, MIRROR_2, MIRROR_4, MIRROR_8, ROTATE_N, SYMMETRIES };
+static volatile int SYMMETRY = SYMMETRY_NONE;
+static const int ROTATIONS = 6;
+static int symmetry_built = -1;
+uint32_t wedge_pixels[WIDTH*HEIGHT]; // raster indices that get evaluated
+uint32_t wedge_source[WIDTH*HEIGHT]; // per raster index, its row in wedge_output
+size_t wedge_count = 0;
+matrix wedge_output = { .x = 0, .y = COLOURS, .e = NULL };
 
+static int pixel_index(int i, int j) {
+    return i * WIDTH + j;
+}
+
+// pixel (i, j) -> the pixel of the fundamental wedge it shows. Rotated, the corners land
+// past the frame's edge along the wedge's ray, so they are mirrored back along it at the
+// edge rather than clamped to it, which would smear the border into streaks.
+static void fold_pixel(enum symmetry mode, int i, int j, int *fi, int *fj) {
+    // centred so that mirrored pixels are exact negatives
+    float dx = j + 0.5f - WIDTH / 2.0f, dy = i + 0.5f - HEIGHT / 2.0f;
+    if (mode == ROTATE_N) {
+        const float wedge = 2.0f * M_PI / ROTATIONS;
+        float radius = hypotf(dx, dy), theta = atan2f(dy, dx) + M_PI;
+        theta = fmodf(theta, wedge) - M_PI;
+        const float c = cosf(theta), s = sinf(theta);
+        // how far the ray at theta runs before it leaves the frame
+        const float reach = fminf(WIDTH / 2.0f / fmaxf(fabsf(c), 1e-6f),
+                HEIGHT / 2.0f / fmaxf(fabsf(s), 1e-6f));
+        if (radius > reach) {
+            radius = fmaxf(2 * reach - radius, 0);
+        }
+        dx = radius * c;
+        dy = radius * s;
+    } else {
+        if (mode >= MIRROR_2) dx = -fabsf(dx);
+        if (mode >= MIRROR_4) dy = -fabsf(dy);
+        if (mode == MIRROR_8 && dy < dx) { // keep the half under the diagonal
+            float swap = dx; dx = dy; dy = swap;
         }
     }
-    seed_network();
-    // initialize the cppn coordinate system
-    float (*input)[WIDTH][INPUT_DIM] = (void *) cppn[0].activations.e;
+    *fj = (int) floorf(dx + WIDTH / 2.0f);
+    *fi = (int) floorf(dy + HEIGHT / 2.0f);
+    // only rounding at the very edge gets this far
+    *fj = *fj < 0 ? 0 : *fj >= WIDTH ? WIDTH - 1 : *fj;
+    *fi = *fi < 0 ? 0 : *fi >= HEIGHT ? HEIGHT - 1 : *fi;
+}
+
+static void build_symmetry(enum symmetry mode) {
+    static int32_t slot[WIDTH*HEIGHT];
+    for(int p=0; p < WIDTH*HEIGHT; ++p) {
+        slot[p] = -1;
+    }
+    wedge_count = 0;
     for(int i=0; i < HEIGHT; ++i) {
         for(int j=0; j < WIDTH; ++j) {
-            if(i %2 == 0) {
-                input[i][j][0] = (float) j / (WIDTH/2) -1.0;
-                input[i][j][1] = (float) i / (HEIGHT/2) -1.0;
-            } else {
-                input[i][j][0] = (float) (WIDTH - (j+1)) / (WIDTH/2) -1.0;
-                input[i][j][1] = (float) i / (HEIGHT/2) -1.0;
+            int fi, fj;
+            fold_pixel(mode, i, j, &fi, &fj);
+            const int source = pixel_index(fi, fj);
+            if(slot[source] < 0) {
+                slot[source] = wedge_count;
+                wedge_pixels[wedge_count++] = source;
             }
+            wedge_source[pixel_index(i, j)] = slot[source];
+        }
+    }
+    wedge_output.x = wedge_count;
+    symmetry_built = mode;
+}
+
+// evaluate whole frames at times t[0..frames) into output (frames * nn_batch_size rows),
+// going through the wedge when a symmetry is on
+static void render_network(const struct cppn_network *net, const float *t, matrix output,
+        int frames) {
+    const int mode = SYMMETRY;
+    set_frame_times(net, t, frames);
+    if(mode == SYMMETRY_NONE) {
+        struct cppn_batch batch = { .net = net, .pixels = NULL, .points = nn_batch_size };
+        matrix input = { .x = output.x, .y = nn_input_size, .e = NULL };
+        feedforward_inference(&nn_pool, net->layer, CPPN_LAYERS, input, output,
+                cppn_first_layer, &batch);
+        return;
+    }
+    if(mode != symmetry_built) {
+        build_symmetry(mode);
+    }
+    struct cppn_batch batch = { .net = net, .pixels = wedge_pixels, .points = wedge_count };
+    matrix input = { .x = wedge_count * frames, .y = nn_input_size, .e = NULL };
+    matrix wedges = { .x = wedge_count * frames, .y = COLOURS, .e = wedge_output.e };
+    feedforward_inference(&nn_pool, net->layer, CPPN_LAYERS, input, wedges,
+            cppn_first_layer, &batch);
+    for(int f=0; f < frames; ++f) {
+        float (*out)[COLOURS] = (void *) (output.e + f * AUDIO_BAND);
+        const float (*wedge)[COLOURS] = (void *) (wedges.e + f * wedge_count * COLOURS);
+        for(int p=0; p < WIDTH*HEIGHT; ++p) {
+            memcpy(out[p], wedge[wedge_source[p]], sizeof(out[p]));
         }
     }
+}
 
+static int seed_network(struct cppn_network *net, struct rng *rng) {
+    for (int i = 0; i < CPPN_LAYERS; ++i) {
+        randomize(rng, net->layer[i].weights.e, 
+                net->layer[i].weights.x * net->layer[i].weights.y, 
+                initialization_sigma);
+        randomize(rng, net->layer[i].bias, net->layer[i].weights.y, initialization_sigma);
+    }
+    cache_coordinates(net);
     return SUCCESS;
 }
 
-void inplace_1d_convolve(
-        float* source,
-        int source_width,
-        float* kernel,
-        int kernel_width
-        ) {
-    float buff[source_width];
-    for(int i = 0; i < source_width; ++i){
-        buff[i] = 0.;
+/// RESEEDING ///
+// Three networks rotate: the one being rendered, the one fading out after a swap, and a
+// spare the seeder thread fills in the background. The producer swaps the spare in by
+// pointer at a cycle boundary (or on 'R') and crossfades for CROSSFADE frames, so a
+// reseed never costs a frame and nothing rewrites weights that are being rendered.
+#define CROSSFADE 6
+struct cppn_network networks[3];
+struct seeder {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct cppn_network *todo; // waiting to be seeded
+    struct cppn_network *spare; // seeded, ready to swap in
+    struct rng rng; // networks come out in the same order for the same SEED
+    pthread_t thread;
+} seeder = { 0 };
+
+static void *seeder_main(void *context) {
+    pthread_mutex_lock(&seeder.lock);
+    for(;;) {
+        while(seeder.todo == NULL) {
+            pthread_cond_wait(&seeder.wake, &seeder.lock);
+        }
+        struct cppn_network *net = seeder.todo;
+        pthread_mutex_unlock(&seeder.lock);
+        seed_network(net, &seeder.rng);
+        pthread_mutex_lock(&seeder.lock);
+        seeder.todo = NULL;
+        seeder.spare = net;
     }
+    return NULL;
+}
 
-    for(int i = 0; i < source_width; i++) {
-        int k_min = fmax(i - kernel_width / 2, 0);
-        int k_max = fmin(i + kernel_width / 2 + 1, source_width);
-        for(int j = k_min; j < k_max; j++) {
-            buff[i] += source[j] * kernel[j - k_min];
+// kaleido_bench.c has no producer, audio or headless run, so leaves out what only they use
+#ifndef KALEIDO_BENCH
+// the seeded spare, handing retired over to be seeded in its place. NULL if not ready yet
+static struct cppn_network *swap_network(struct cppn_network *retired) {
+    pthread_mutex_lock(&seeder.lock);
+    struct cppn_network *next = seeder.spare;
+    if(next) {
+        seeder.spare = NULL;
+        seeder.todo = retired;
+        pthread_cond_signal(&seeder.wake);
+    }
+    pthread_mutex_unlock(&seeder.lock);
+    return next;
+}
+#endif
+
+static int init_neural_network() {
+    for (int n = 0; n < 3; ++n) {
+        struct cppn_network *net = &networks[n];
+        for (int i = 0; i < CPPN_LAYERS; ++i) {
+            net->layer[i] = cppn[i];
+            net->layer[i].weights.x = i == 0 ? nn_input_size : hidden_neurons;
+            net->layer[i].weights.y = i == CPPN_LAYERS - 1 ? output_neurons : hidden_neurons;
+            net->layer[i].weights.e = malloc(net->layer[i].weights.x * net->layer[i].weights.y * 
+                    sizeof(float));
+            net->layer[i].bias = malloc(net->layer[i].weights.y * sizeof(float));
         }
+        net->x_term = malloc(WIDTH * hidden_neurons * sizeof(float));
+        net->y_term = malloc(HEIGHT * hidden_neurons * sizeof(float));
     }
-    memmove(source, buff, source_width * sizeof(float));
+    wedge_output.e = calloc(FRAME_BATCH * nn_output.x * nn_output.y, sizeof(float));
+    cppn_row_term = malloc(FRAME_BATCH * HEIGHT * hidden_neurons * sizeof(float));
+    rng_seed(&seeder.rng, SEED, 0);
+    rng_seed(&beats_rng, SEED, 1);
+    seed_network(&networks[0], &seeder.rng);
+    seed_network(&networks[1], &seeder.rng);
+    seeder.spare = &networks[1];
+
+    retfail(-pthread_mutex_init(&seeder.lock, NULL));
+    retfail(-pthread_cond_init(&seeder.wake, NULL));
+    retfail(-pthread_create(&seeder.thread, NULL, seeder_main, NULL));
+    return SUCCESS;
+}
+
+/// TIMING ///
+enum frame_stage { STAGE_INFERENCE, STAGE_PIANO, STAGE_MELODY, STAGE_BEATS, STAGE_PUBLISH,
+    STAGE_UPLOAD, STAGE_DISPLAY, FRAME_STAGES };
+static const char *const stage_names[FRAME_STAGES] = {
+    "inference", "piano", "melody", "beats", "publish", "upload", "display" };
+struct timing_export timing = { 0 };
+
+/// FRAME QUEUE ///
+// The network is a pure function of (x, y, t), so a producer thread renders ahead of the
+// timer, FRAME_BATCH frames per pass stacked into one batch, into a ring of slots.
+// display() takes the slot for the current tick and holds it until the next display();
+// when the producer is behind it just shows the last frame again rather than waiting.
+// The producer owns the timeline: it swaps in the seeder's spare network whenever a tick
+// crosses into a new cycle and crossfades from the old one.
+#define FRAME_QUEUE 6
+static const int CYCLE = 60 * SECONDS + 1; // ticks per seed, t runs over 0..60*SECONDS
+static volatile int RESEED = 0;
+struct frame_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t space, ready;
+    float *frames; // [FRAME_QUEUE][AUDIO_BAND]
+    int ticks[FRAME_QUEUE];
+    uint32_t render_ns[FRAME_QUEUE]; // the batch's inference time, per frame
+    uint32_t dropped, missed; // frames rendered but shown too late, displays with nothing new
+    int head, count; // ready frames, oldest first
+    int held; // slot display() is showing, -1 for none
+    int next_tick; // first tick the producer hasn't rendered
+    unsigned long generation; // bumped to throw away anything in flight
+    pthread_t producer;
+} queue = { .held = -1 };
+
+// With the lock held: the producer renders into *tail onwards, and this many slots of it
+// are free, contiguous and short of the slot display() holds. Dropped frames and misses
+// move head without moving held, so held is only just behind head while the queue is
+// being consumed in order; an empty queue starts again right after held.
+static int queue_space(int *tail) {
+    if(queue.count == 0 && queue.held >= 0) {
+        queue.head = (queue.held + 1) % FRAME_QUEUE;
+    }
+    *tail = (queue.head + queue.count) % FRAME_QUEUE;
+    int frames = queue.held >= 0 ? (queue.held - *tail + FRAME_QUEUE) % FRAME_QUEUE :
+        FRAME_QUEUE - queue.count;
+    frames = frames < FRAME_BATCH ? frames : FRAME_BATCH;
+    return frames < FRAME_QUEUE - *tail ? frames : FRAME_QUEUE - *tail;
+}
+
+// With the lock held: frames rendered into tail onwards for tick onwards are ready
+static void queue_publish(int tail, int frames, int tick, uint32_t render_ns) {
+    for(int f=0; f < frames; ++f) {
+        queue.ticks[(tail + f) % FRAME_QUEUE] = tick + f;
+        queue.render_ns[(tail + f) % FRAME_QUEUE] = render_ns;
+    }
+    queue.count += frames;
+    queue.next_tick = tick + frames;
+    pthread_cond_broadcast(&queue.ready);
+}
+
+#ifndef KALEIDO_BENCH
+static float network_time(const struct cppn_network *net, int tick) {
+    return (float) (tick - net->origin) / (SECONDS * FPS / 2) -1.0;
+}
+
+static void *frame_producer(void *context) {
+    // current, the seeder's spare and one of fading / idle account for all three networks
+    struct cppn_network *current = &networks[0], *fading = NULL, *idle = &networks[2];
+    int fade_start = 0;
+    float *fade_frames = malloc(FRAME_BATCH * AUDIO_BAND * sizeof(float));
+    current->origin = 0;
+    for(;;) {
+        pthread_mutex_lock(&queue.lock);
+        int tail, frames;
+        while((frames = queue_space(&tail)) == 0) {
+            pthread_cond_wait(&queue.space, &queue.lock);
+        }
+        const int tick = queue.next_tick > frame_count ? queue.next_tick : frame_count;
+        const unsigned long generation = queue.generation;
+        const int reseed = RESEED;
+        RESEED = 0;
+        pthread_mutex_unlock(&queue.lock);
+
+        const int new_cycle = tick - current->origin >= CYCLE;
+        if(reseed || new_cycle) {
+            // a swap in the middle of a fade cuts the older network off early
+            struct cppn_network *next = swap_network(fading ? fading : idle);
+            if(next) {
+                idle = NULL;
+                next->origin = new_cycle ? tick - (tick - current->origin) % CYCLE :
+                    current->origin;
+                fading = current;
+                current = next;
+                fade_start = tick;
+            } else if(reseed) { // try again next batch
+                RESEED = 1;
+            }
+        }
+        // don't run one network's time past its cycle within a batch
+        while(frames > 1 && tick - current->origin < CYCLE &&
+                tick + frames - 1 - current->origin >= CYCLE) {
+            --frames;
+        }
+        uint64_t start = monotonic_ns();
+        float t[FRAME_BATCH];
+        for(int f=0; f < frames; ++f) {
+            t[f] = network_time(current, tick + f);
+        }
+        matrix output = { .x = frames * nn_batch_size, .y = COLOURS,
+            .e = queue.frames + tail * AUDIO_BAND };
+        render_network(current, t, output, frames);
+
+        if(fading) { // the old network carries on with its own clock underneath
+            for(int f=0; f < frames; ++f) {
+                t[f] = network_time(fading, tick + f);
+            }
+            matrix faded = { .x = output.x, .y = COLOURS, .e = fade_frames };
+            render_network(fading, t, faded, frames);
+            for(int f=0; f < frames; ++f) {
+                float mix = (float) (tick + f - fade_start + 1) / (CROSSFADE + 1);
+                mix = mix < 1.0 ? mix : 1.0;
+                float *out = output.e + f * AUDIO_BAND, *old = fade_frames + f * AUDIO_BAND;
+                for(int i=0; i < AUDIO_BAND; ++i) {
+                    out[i] = old[i] + mix * (out[i] - old[i]);
+                }
+            }
+            if(tick + frames - fade_start >= CROSSFADE) {
+                idle = fading;
+                fading = NULL;
+            }
+        }
+
+        const uint32_t render_ns = lap_ns(&start) / frames;
+        pthread_mutex_lock(&queue.lock);
+        if(generation == queue.generation) {
+            queue_publish(tail, frames, tick, render_ns);
+        }
+        pthread_mutex_unlock(&queue.lock);
+    }
+    return NULL;
+}
+#endif
+
+// the frame for tick, or NULL when it isn't ready yet unless wait is set, in which case
+// it blocks until the producer gets there. Releases the previous frame.
+static float *next_frame(int tick, int wait) {
+    float *frame = NULL;
+    pthread_mutex_lock(&queue.lock);
+    for(;;) {
+        while(queue.count > 0 && queue.ticks[queue.head] < tick) { // too late to show
+            queue.head = (queue.head + 1) % FRAME_QUEUE;
+            queue.count--;
+            queue.dropped++;
+        }
+        if(queue.count > 0 && queue.ticks[queue.head] == tick) {
+            queue.held = queue.head;
+            frame = queue.frames + queue.held * AUDIO_BAND;
+            queue.head = (queue.head + 1) % FRAME_QUEUE;
+            queue.count--;
+        }
+        if(frame) {
+            break;
+        }
+        if(!wait) {
+            queue.missed++;
+            break;
+        }
+        pthread_cond_signal(&queue.space);
+        pthread_cond_wait(&queue.ready, &queue.lock);
+    }
+    pthread_cond_signal(&queue.space);
+    pthread_mutex_unlock(&queue.lock);
+    return frame;
+}
+
+// drop everything queued and start again from the next tick on a fresh network
+static void request_reseed() {
+    pthread_mutex_lock(&queue.lock);
+    RESEED = 1;
+    queue.generation++;
+    queue.count = 0;
+    queue.next_tick = frame_count;
+    pthread_cond_signal(&queue.space);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+#ifndef KALEIDO_BENCH
+static int init_frame_queue() {
+    queue.frames = calloc(FRAME_QUEUE * AUDIO_BAND, sizeof(float));
+    retfail(-pthread_mutex_init(&queue.lock, NULL));
+    retfail(-pthread_cond_init(&queue.space, NULL));
+    retfail(-pthread_cond_init(&queue.ready, NULL));
+    retfail(-pthread_create(&queue.producer, NULL, frame_producer, NULL));
+    return SUCCESS;
+}
+#endif
+
+/* Convolves impulses (at ascending positions, of a signal width long) with kernel into
+ * mask's runs. Output i sums signal[j] * kernel[j - max(i - kw/2, 0)] for j within kw/2
+ * of i, in the order a dense pass over the whole signal would, so nothing rounds
+ * differently; it only visits entries near an impulse. */
+static retcode convolve_harmonics(struct harmonic_mask *mask, const int *position,
+        const float *weight, int impulses, int width, const float *kernel, int kw) {
+    mask->runs = 0;
+    int used = 0;
+    for(int first=0; first < impulses; ) {
+        // impulses whose reach overlaps share a run
+        int last = first;
+        while(last + 1 < impulses && position[last + 1] - position[last] <= kw) {
+            ++last;
+        }
+        const int start = fmax(position[first] - kw / 2, 0);
+        const int end = fmin(position[last] + kw / 2 + 1, width);
+        retfail(-(mask->runs == MAX_OCTAVES || used + end - start > MAX_HARMONIC_WEIGHTS));
+        struct harmonic_run *run = &mask->run[mask->runs++];
+        float *out = mask->weights + used;
+        run->start = start;
+        run->length = end - start;
+        run->weights = out;
+        used += run->length;
+        for(int i=start; i < end; ++i) {
+            const int k_min = fmax(i - kw / 2, 0);
+            const int k_max = fmin(i + kw / 2 + 1, width);
+            float sum = 0.;
+            for(int m=first; m <= last; ++m) {
+                if(position[m] >= k_min && position[m] < k_max) {
+                    sum += weight[m] * kernel[position[m] - k_min];
+                }
+            }
+            out[i - start] = sum;
+        }
+        first = last + 1;
+    }
+    return SUCCESS;
 }
 
 /// AUDIO CODE ///
-// This can be called at interrupt level, so nothing fancy, no malloc/free
-static int audio_callback(
-        const void *inputBuffer, // unused
-        void *outputBuffer,
-        unsigned long framesPerBuffer, // This is defined in setup 64
-        const PaStreamCallbackTimeInfo* timeInfo, // unused
-        PaStreamCallbackFlags stats, // unused
-        void *context ) {
+// render side: hand the frame to the callback, take back whichever buffer is free
+static void publish_audio(const float *frame) {
+    memcpy(audio_buffers[audio_back], frame, AUDIO_BAND * sizeof(float));
+    audio_back = atomic_exchange_explicit(&audio_shared, audio_back | AUDIO_FRESH,
+            memory_order_acq_rel) & ~AUDIO_FRESH;
+}
 
-    LRAudioBuf *audio_buf = (LRAudioBuf*)context;
-    float *out = (float*)outputBuffer;
+// callback side: the newest published buffer if there is one, else keep playing front
+static int latest_audio(int front) {
+    if(!(atomic_load_explicit(&audio_shared, memory_order_relaxed) & AUDIO_FRESH)) {
+        return front;
+    }
+    return atomic_exchange_explicit(&audio_shared, front, memory_order_acq_rel) & ~AUDIO_FRESH;
+}
+
+// frames stereo frames from [pixel][colour] samples, walking pixels by step (1 or -1).
+// left, right and step are constants in each caller so the loop vectorizes into
+// permutes rather than gathers.
+static inline __attribute__((always_inline)) void stereo_run(float *restrict out,
+        const float *restrict src, size_t frames, int left, int right, int step,
+        float volume) {
+    for(size_t k=0; k < frames; ++k) {
+        const ptrdiff_t pixel = step * (ptrdiff_t) k;
+        out[2 * k] = src[COLOURS * pixel + left] * volume;
+        out[2 * k + 1] = src[COLOURS * pixel + right] * volume;
+    }
+}
 
-    for(unsigned long i=0; i<framesPerBuffer; ++i) {
-        *out++ = audio_double_buf[audio_buf->left_phase]
-            [audio_buf->colourphase]
-            * volumeMultiplier;
-        // right
-        *out++ = audio_double_buf[audio_buf->left_phase]
-            [(audio_buf->colourphase + 1) % COLOURS]
-            * volumeMultiplier;
-        audio_buf->left_phase ++;
+// left plays colour, right the next one round. Backwards runs start at src's last pixel.
+static void stereo_block(float *out, const float *src, size_t frames, int colour,
+        int backwards, float volume) {
+    switch(colour + backwards * COLOURS) {
+    case 0: stereo_run(out, src, frames, 0, 1, 1, volume); break;
+    case 1: stereo_run(out, src, frames, 1, 2, 1, volume); break;
+    case 2: stereo_run(out, src, frames, 2, 0, 1, volume); break;
+    case 3: stereo_run(out, src, frames, 0, 1, -1, volume); break;
+    case 4: stereo_run(out, src, frames, 1, 2, -1, volume); break;
+    default: stereo_run(out, src, frames, 2, 0, -1, volume); break;
+    }
+}
+
+// framesPerBuffer stereo frames at SAMPLE_RATE. left_phase counts in snake order, so it
+// copies whole rows, odd ones backwards, and the bookkeeping happens once per row.
+static void synth_audio(LRAudioBuf *audio_buf, float *out, unsigned long framesPerBuffer) {
+    for(unsigned long done=0; done < framesPerBuffer; ) {
+        if(audio_buf->left_phase == 0) { // a clean boundary, pick up the newest frame
+            const int latest = latest_audio(audio_buf->front);
+            audio_buf->primed |= latest != audio_buf->front;
+            audio_buf->front = latest;
+        }
+        if(!audio_buf->primed) { // hold at the start until there is something to play
+            memset(out + 2 * done, 0, 2 * (framesPerBuffer - done) * sizeof(float));
+            break;
+        }
+        const int row = audio_buf->left_phase / WIDTH, column = audio_buf->left_phase % WIDTH;
+        unsigned long run = WIDTH - column;
+        run = run < framesPerBuffer - done ? run : framesPerBuffer - done;
+        const float (*playing)[COLOURS] = audio_buffers[audio_buf->front];
+        const int backwards = row % 2;
+        const int pixel = row * WIDTH + (backwards ? WIDTH - 1 - column : column);
+        stereo_block(out + 2 * done, playing[pixel], run, audio_buf->colourphase, backwards,
+                volumeMultiplier);
+        done += run;
+        audio_buf->left_phase += run;
         if(audio_buf->left_phase >= WIDTH*HEIGHT) {
             audio_buf->left_phase -= WIDTH*HEIGHT;
             audio_buf->colourphase = (audio_buf->colourphase + 1) % 3;
@@ -192,18 +677,125 @@ static int audio_callback(
             }
         }
     }
+}
+
+// This can be called at interrupt level, so nothing fancy, no malloc/free
+static int audio_callback(
+        const void *inputBuffer, // unused
+        void *outputBuffer,
+        unsigned long framesPerBuffer, // This is defined in setup 64
+        const PaStreamCallbackTimeInfo* timeInfo, // unused
+        PaStreamCallbackFlags stats, // unused
+        void *context ) {
+
+    LRAudioBuf *audio_buf = (LRAudioBuf*)context;
+    float *out = (float*)outputBuffer;
+
+    if(!audio_buf->resampling) {
+        synth_audio(audio_buf, out, framesPerBuffer);
+        return paContinue;
+    }
+    for(unsigned long done=0; done < framesPerBuffer; ) {
+        unsigned long chunk = framesPerBuffer - done;
+        chunk = chunk < RESAMPLE_CHUNK ? chunk : RESAMPLE_CHUNK;
+        size_t inputs;
+        float *in = resample_input(&audio_buf->resampler, chunk, &inputs);
+        synth_audio(audio_buf, in, inputs);
+        resample_output(&audio_buf->resampler, out + 2 * done, chunk);
+        done += chunk;
+    }
     return paContinue;
 }
 
+#ifndef KALEIDO_BENCH
 static void cleanup(void *context) {
     LRAudioBuf *audio_buf = (LRAudioBuf*)context;
     free(audio_buf->cfg);
 }
+#endif
 
 int near(float a, float b, float epsilon) {
     return (a + epsilon > b && a - epsilon < b);
 }
 
+// Melody listens to every bar of every colour, BARS_PER_FRAME * COLOURS signals spread
+// over the effects pool, for the keys' harmonics and mixes in the loudest key's tone.
+// Signal t is bar t % BARS_PER_FRAME of colour t / BARS_PER_FRAME. A bar sees the first
+// BAR_LENGTH entries of the masks, so harmonic h of a key is complex bin position[h] / 2
+// of the bar's spectrum, and one Goertzel filter per harmonic, a vector lane each, gets
+// its magnitude without transforming the bar.
+#define MELODY_SIGNALS (BARS_PER_FRAME * COLOURS)
+#define MELODY_LANES (NUM_KEYS * MAX_OCTAVES + VLEN) // room to round up to whole vectors
+struct melody_bank {
+    int lanes; // harmonics below BAR_LENGTH, every lane past them is 0
+    float coefficient[MELODY_LANES]; // 2 cos(2 pi bin / BAR_LENGTH)
+    float weight[MELODY_LANES]; // the harmonic's share of its key's weight
+    int key[MELODY_LANES];
+    float tone[NUM_KEYS][BAR_LENGTH]; // the key's harmonics by share, all at phase 0
+};
+static struct melody_bank melody;
+static const float melody_volume = 0.2;
+
+// a lane per harmonic below BAR_LENGTH, and each key's tone
+static void init_melody() {
+    memset(&melody, 0, sizeof(melody));
+    for(int key=0; key < NUM_KEYS; ++key) {
+        const struct harmonic_mask *mask = &harmonics[key];
+        const int first = melody.lanes;
+        float total = 0;
+        for(int h=0; h < mask->octaves && mask->position[h] < BAR_LENGTH; ++h) {
+            const int bin = mask->position[h] / 2;
+            melody.coefficient[melody.lanes] = 2 * cos(2 * M_PI * bin / BAR_LENGTH);
+            melody.weight[melody.lanes] = mask->weight[h];
+            melody.key[melody.lanes++] = key;
+            total += mask->weight[h];
+        }
+        for(int l=first; l < melody.lanes; ++l) {
+            melody.weight[l] /= total;
+        }
+        for(int j=0; j < BAR_LENGTH; ++j) {
+            double sum = 0;
+            for(int l=first; l < melody.lanes; ++l) {
+                const long bin = mask->position[l - first] / 2;
+                sum += melody.weight[l] * cos(2 * M_PI * (bin * j % BAR_LENGTH) / BAR_LENGTH);
+            }
+            melody.tone[key][j] = sum;
+        }
+    }
+}
+
+// setup key structures, the piano and melody filters
+static retcode init_harmonics() {
+    BANDPASS = 15000. / (SAMPLE_RATE / (float) AUDIO_BAND);
+    float sq_gaussian_kernel[glen*2];
+    memset(sq_gaussian_kernel, 0.0, glen*2*sizeof(float));
+    for( int i =0; i < glen; ++i) {
+        sq_gaussian_kernel[i*2] = sqrt(sqrt(gaussian_kernel[i]));
+    }
+    for(int note=0; note < sizeof(freqs) / sizeof(float); ++note) {
+        //int bin = (int) (round((freqs[note]/2.0) / (SAMPLE_RATE/ (float) AUDIO_BAND)));
+        int bin = (int) round(freqs[note] / 4.0 * SAMPLE_RATE/ (float) AUDIO_BAND);
+        printf("bin: %d\n", bin);
+        int position[MAX_OCTAVES];
+        float weight[MAX_OCTAVES];
+        int octaves = 0;
+        float falloff = 100.0;
+        for(; bin > 0 && bin < AUDIO_BAND && octaves < MAX_OCTAVES; bin *= 2.0) { // double for octave and phase
+            position[octaves] = bin;
+            weight[octaves++] = 1.0 * falloff;
+            falloff *= 1.5;
+        }
+        retfail(convolve_harmonics(&harmonics[note], position, weight, octaves, AUDIO_BAND,
+                    sq_gaussian_kernel, glen));
+        harmonics[note].octaves = octaves;
+        memcpy(harmonics[note].position, position, octaves * sizeof(int));
+        memcpy(harmonics[note].weight, weight, octaves * sizeof(float));
+    }
+    init_melody();
+    return SUCCESS;
+}
+
+#ifndef KALEIDO_BENCH
 static int init_portaudio() {
     PaStreamParameters outputParameters = { 0 };
     memset(&outputParameters, 0, sizeof(outputParameters));
@@ -235,177 +827,231 @@ static int init_portaudio() {
         Pa_GetDeviceInfo( outputParameters.device )->defaultLowOutputLatency;
     outputParameters.hostApiSpecificStreamInfo = NULL;
 
+    // portaudio reports the rate as a double; round it, the resampler wants whole hertz
+    const int device_rate = lrint(Pa_GetDeviceInfo( outputParameters.device )->defaultSampleRate);
+    if(NATIVE_RATE && SAMPLE_RATE != device_rate) {
+        SAMPLE_RATE = device_rate;
+        retfail(init_harmonics());
+    }
+    if(SAMPLE_RATE != device_rate) {
+        printf("Resampling %.0f Hz to the device's %d Hz\n", SAMPLE_RATE, device_rate);
+        retfail(resampler_init(&audio_buf.resampler, lrint(SAMPLE_RATE), device_rate, 32));
+        audio_buf.resampling = 1;
+    }
+
     retfail(Pa_OpenStream(
                 &stream,
                 NULL, // no input
                 &outputParameters,
-                44100.0, //SAMPLE_RATE, // sample rate
+                device_rate, // sample rate
                 paFramesPerBufferUnspecified, // sample frames per buffer
                 paNoFlag,
                 audio_callback,
                 &audio_buf )); // this is context in the callback
 
     retfail(Pa_SetStreamFinishedCallback(stream, &cleanup));
+    return SUCCESS;
+}
+#endif
 
-    float sq_gaussian_kernel[glen*2];
-    memset(sq_gaussian_kernel, 0.0, glen*2*sizeof(float));
-    for( int i =0; i < glen; ++i) {
-        sq_gaussian_kernel[i*2] = sqrt(sqrt(gaussian_kernel[i]));
-    }
-    // setup key structures //
-    for(int i = 0; i < AUDIO_BAND; i++) for(int j = 0; j < NUM_KEYS; j++) harmonics[j][i] = 0.;
-    for(int note=0; note < sizeof(freqs) / sizeof(float); ++note) {
-        //int bin = (int) (round((freqs[note]/2.0) / (SAMPLE_RATE/ (float) AUDIO_BAND)));
-        int bin = (int) round(freqs[note] / 4.0 * SAMPLE_RATE/ (float) AUDIO_BAND);
-        printf("bin: %d\n", bin);
-        float falloff = 100.0;
-        for(; bin < AUDIO_BAND; bin *= 2.0) { // double for octave and phase
-            harmonics[note][bin] = 1.0 * falloff;
-            falloff *= 1.5;
+
+// neural piano: keep the harmonics of one key in the frame's spectrum
+static void piano_filter(float *output, int key) {
+    // the complex bins the key's runs touch up to BANDPASS, a weight for each half.
+    // Everything else is zero, bar the nyquist bin past the mask, which keeps its real part.
+    const struct harmonic_mask *mask = &harmonics[key];
+    const int band = fmin(BANDPASS, AUDIO_BAND - 1);
+    int bins[MAX_HARMONIC_WEIGHTS + 1], count = 0;
+    float weights[MAX_HARMONIC_WEIGHTS + 1][2];
+    for(int r=0; r < mask->runs; ++r) {
+        const struct harmonic_run *run = &mask->run[r];
+        for(int i=run->start; i < run->start + run->length && i <= band; ++i) {
+            if(count == 0 || bins[count - 1] != i / 2) {
+                bins[count] = i / 2;
+                weights[count][0] = weights[count][1] = 0.f;
+                count++;
+            }
+            weights[count - 1][i % 2] = run->weights[i - run->start];
         }
-        inplace_1d_convolve(harmonics[note], (int) AUDIO_BAND, sq_gaussian_kernel, glen);
     }
+    bins[count] = AUDIO_BAND / 2;
+    weights[count][0] = weights[count][1] = 1.f;
+    count++;
 
+    // only those bins are transformed, there and back
+    kiss_fftr_bins(full_fftr_cfg, output, (kiss_fft_cpx *) frequency_space, bins, count);
+    for(int b=0; b < count; ++b) {
+        frequency_space[2 * bins[b]] *= weights[b][0];
+        frequency_space[2 * bins[b] + 1] *= weights[b][1];
+    }
+    kiss_fftri_bins(full_fftri_cfg, (kiss_fft_cpx *) frequency_space, bins, count, output);
 
-
-    return SUCCESS;
+    for(int i=0; i < AUDIO_BAND; ++i) { // normalize
+        output[i] /= AUDIO_BAND;
+    }
 }
 
-void display() {
-    float (*input)[WIDTH][INPUT_DIM] = (void *) cppn[0].activations.e;
-
-    for(int i=0; i < HEIGHT; ++i) {
-        for(int j=0; j < WIDTH; ++j) {
-            // coordinates are static, just the time
-            input[i][j][2] = (float) frame_count / (SECONDS * FPS / 2) -1.0;
+// |X[bin]| of a bar, x strided by COLOURS, for every lane of the bank
+static void goertzel_bank(const float *x, float *magnitude) {
+    const int blocks = (melody.lanes + VLEN - 1) / VLEN;
+    vfloat s1[MELODY_LANES / VLEN], s2[MELODY_LANES / VLEN], c[MELODY_LANES / VLEN];
+    for(int b=0; b < blocks; ++b) {
+        s1[b] = s2[b] = v_set1(0);
+        c[b] = v_load(melody.coefficient + b * VLEN);
+    }
+    // no harmonic is bin 0, and without the bar's dc the low bins' filters don't wind
+    // up to where float rounding swamps them
+    float mean = 0;
+    for(int j=0; j < BAR_LENGTH; ++j) {
+        mean += x[j * COLOURS];
+    }
+    mean /= BAR_LENGTH;
+    for(int j=0; j < BAR_LENGTH; ++j) {
+        const vfloat in = v_set1(x[j * COLOURS] - mean);
+        for(int b=0; b < blocks; ++b) { // s[j] = x[j] + c s[j-1] - s[j-2]
+            const vfloat s0 = v_fma(c[b], s1[b], v_sub(in, s2[b]));
+            s2[b] = s1[b];
+            s1[b] = s0;
         }
     }
+    for(int b=0; b < blocks; ++b) { // |X|^2 = s1^2 + s2^2 - c s1 s2
+        const vfloat power = v_fma(s1[b], v_sub(s1[b], v_mul(c[b], s2[b])), v_mul(s2[b], s2[b]));
+        v_store(magnitude + b * VLEN, v_sqrt(v_max(power, v_set1(0))));
+    }
+}
 
-    matrix res = feedforward(cppn, num_layers);
-
-    if(CLAMP_KEY != INT_MAX) { // neural piano
-        float (*output) = 
-            (void *) cppn[last_layer].activations.e;
-        kiss_fftr(full_fftr_cfg, 
-                output,
-                (kiss_fft_cpx *) frequency_space);
-
-        for(int i=0; i < AUDIO_BAND; i ++) {
-            frequency_space[i] *= harmonics[CLAMP_KEY][i];
+// mix the nearest note into signals [begin, end) of the frame
+static void melody_signals(void *context, size_t begin, size_t end, int worker) {
+    float *frame = context;
+    for(size_t t=begin; t < end; ++t) {
+        float *bar = frame + (t % BARS_PER_FRAME) * BAR_LENGTH * COLOURS + t / BARS_PER_FRAME;
+        float magnitude[MELODY_LANES];
+        goertzel_bank(bar, magnitude);
 
-            if(i > BANDPASS) {
-                frequency_space[i] = 0.f;
+        // find the nearest note
+        float score[NUM_KEYS] = {0};
+        for(int l=0; l < melody.lanes; ++l) {
+            score[melody.key[l]] += melody.weight[l] * magnitude[l];
+        }
+        int note = 0;
+        for(int key=1; key < NUM_KEYS; ++key) {
+            if(score[key] > score[note]) {
+                note = key;
             }
         }
 
-        kiss_fftri(full_fftri_cfg, 
-                (kiss_fft_cpx *) frequency_space,
-                output);
-
-        for(int i=0; i < AUDIO_BAND; ++i) { // normalize
-            cppn[last_layer].activations.e[i] /= AUDIO_BAND;
-        }
-
-    } else { 
-        float (*output)[BAR_LENGTH][COLOURS] = 
-            (void *) cppn[last_layer].activations.e;
-        if (MELODY_ON) {
-            float melody_volume = 0.2;
-            int nearest_note = 0;
-            assert(AUDIO_BAND % BAR_LENGTH == 0);
-
-            for(int b=0; b < BARS_PER_FRAME; ++b) {
-                for(int c=0; c < COLOURS; ++c) {
-                    float note_real[BAR_LENGTH] = { 0 };
-                    float note_freq[BAR_LENGTH] = { 0 };
-                    int max_activations [12] = { 0 };
-                    for (int j=0; j < BAR_LENGTH; ++j) {
-                        note_real[j] = output[b][j][c]; 
-                    }
-                    kiss_fftr(bar_fftr_cfg, 
-                            note_real,
-                            (kiss_fft_cpx *) note_freq);
-                    // scan for the max entry and play that note
-                    int max_activation = 0;
-                    for (int j=0; j < BAR_LENGTH; ++j) {
-                        if(note_freq[j] > note_freq[max_activation]) {
-                            max_activation = j;
-                        }
-                    }
-                    // find the nearest note
-                    int max_note = 0;
-                    float max_val = 0.0;
-                    float cur_val = 0.0;
-                    for(int cur_note=0; cur_note < NUM_KEYS; ++cur_note) {
-                        for(int j=0; j < BAR_LENGTH; ++j) {
-                            cur_val += 
-                                note_freq[j] * harmonics[max_note][j] / BAR_LENGTH;
-                            if(cur_val > max_val) {
-                                max_val = cur_val;
-                                max_note = cur_note;
-                            }
-                        }
-                    }
-                    
-                    for(int j=0; j < BAR_LENGTH; ++j) {
-                        note_freq[j] *= harmonics[max_note][j] / BAR_LENGTH;
-                    }
-                    kiss_fftr(bar_fftr_cfg, 
-                            (kiss_fft_cpx *) note_freq,
-                            note_real);
-
-                    for(int j=0; j < BAR_LENGTH; ++j) { // normalize and add
-                        output[b][j][c] = (output[b][j][c] * (1-melody_volume)) + 
-                            note_real[j] * melody_volume;
-                    }
-                }
-            }
+        // a sinusoid of amplitude a has |X| = a BAR_LENGTH / 2
+        const float amplitude = 2 * score[note] / BAR_LENGTH * melody_volume;
+        for(int j=0; j < BAR_LENGTH; ++j) {
+            bar[j * COLOURS] = (bar[j * COLOURS] * (1-melody_volume)) +
+                melody.tone[note][j] * amplitude;
         }
+    }
+}
 
-        if(BEATS_ON) {
-            float beats_real[BAR_LENGTH] = {0};
-            float beats_freq[BAR_LENGTH] = {0};
-            randomize(beats_freq, BAR_LENGTH, initialization_sigma);
-            for(int i=0; i < BAR_LENGTH; ++i) {
-                beats_freq[i] += sqrt(BAR_LENGTH - i);
-            }
+// mix the nearest note into each bar of each colour
+static void melody_filter(float *frame) {
+    assert(AUDIO_BAND % BAR_LENGTH == 0);
+    pool_run(&effects_pool, melody_signals, frame, MELODY_SIGNALS, 1);
+}
+
+// a random bar of drums under every bar
+static void add_beats(float *frame, struct rng *rng) {
+    float (*output)[BAR_LENGTH][COLOURS] = (void *) frame;
+    float beats_real[BAR_LENGTH] = {0};
+    float beats_freq[BAR_LENGTH + 2] = {0};
+    randomize(rng, beats_freq, BAR_LENGTH, initialization_sigma);
+    for(int i=0; i < BAR_LENGTH; ++i) {
+        beats_freq[i] += sqrt(BAR_LENGTH - i);
+    }
 
-            kiss_fftri(bar_fftri_cfg,
-                (kiss_fft_cpx *) beats_freq,
-                beats_real);
+    kiss_fftri(bar_fftri_cfg,
+        (kiss_fft_cpx *) beats_freq,
+        beats_real);
 
-            for(int b=0; b < BARS_PER_FRAME; ++b) {
-                for(int i=0; i < BAR_LENGTH; ++i) {
-                    for(int c=0; c < COLOURS; ++c) {
-                        output[b][i][c] += beats_real[i] / i;
-                    }
-                }
+    for(int b=0; b < BARS_PER_FRAME; ++b) {
+        for(int i=0; i < BAR_LENGTH; ++i) {
+            for(int c=0; c < COLOURS; ++c) {
+                output[b][i][c] += beats_real[i] / i;
             }
         }
     }
+}
 
-    memcpy(audio_double_buf, cppn[last_layer].activations.e, AUDIO_BAND * sizeof(float));
-
-    // unsnake what gets rendered, or it's super abstract and doesn't look cppn
-    float (*square_nn_output)[WIDTH][COLOURS] = 
-        (void *) cppn[last_layer].activations.e;
+// raster <-> snake order, it is its own inverse: copy even rows, reverse odd ones
+static void reverse_odd_rows(float *restrict to, const float *restrict from) {
     for(int i=0; i < HEIGHT; ++i) {
+        const float (*src)[COLOURS] = (const void *) (from + i * WIDTH * COLOURS);
+        float (*dst)[COLOURS] = (void *) (to + i * WIDTH * COLOURS);
+        if(i % 2 == 0) {
+            memcpy(dst, src, WIDTH * sizeof(*dst));
+            continue;
+        }
         for(int j=0; j < WIDTH; ++j) {
             for(int k=0; k < COLOURS; ++k) {
-                if(i %2 == 0) {
-                    framebuffer_unsnake[i][j][k] = square_nn_output[i][j][k];
-                } else {
-                    framebuffer_unsnake[i][WIDTH - (j+1)][k] = square_nn_output[i][j][k];
-                }
+                dst[WIDTH - 1 - j][k] = src[j][k];
             }
         }
     }
+}
 
-    render_buffer((float *) &framebuffer_unsnake);
+// everything display() does to a frame short of drawing it: the audio effects, which
+// work in snake order, and handing it to the audio callback. Starts timing's record for
+// the frame, stages that don't run stay at 0.
+static void synthesize_frame(float *frame, int tick, struct frame_timing *timing) {
+    uint64_t mark = monotonic_ns();
+    memset(timing, 0, sizeof(*timing));
+    timing->frame = tick;
+    timing->stage_ns[STAGE_INFERENCE] = queue.render_ns[queue.held];
+    timing->dropped = queue.dropped;
+    timing->missed = queue.missed;
+
+    nn_output.e = frame;
+    const int key = CLAMP_KEY, melody = MELODY_ON, beats = BEATS_ON;
+    if(key != INT_MAX || melody || beats) {
+        reverse_odd_rows((float *) snake_frame, frame);
+        if(key != INT_MAX) {
+            piano_filter((float *) snake_frame, key);
+            timing->stage_ns[STAGE_PIANO] = lap_ns(&mark);
+        } else { 
+            if (melody) {
+                melody_filter((float *) snake_frame);
+                timing->stage_ns[STAGE_MELODY] = lap_ns(&mark);
+            }
+            if(beats) {
+                add_beats((float *) snake_frame, &beats_rng);
+                timing->stage_ns[STAGE_BEATS] = lap_ns(&mark);
+            }
+        }
+        reverse_odd_rows(frame, (float *) snake_frame);
+    }
+
+    publish_audio(frame);
+    timing->stage_ns[STAGE_PUBLISH] = lap_ns(&mark);
+}
+
+void display() {
+    const uint64_t start = monotonic_ns();
+    const int tick = frame_count;
+    float *frame = next_frame(tick, 0);
+    if(frame == NULL) { // the producer is behind, don't wait on it
+        if(shown_frame) {
+            render_buffer(shown_frame);
+        }
+        return;
+    }
+    struct frame_timing frame_timing;
+    synthesize_frame(frame, tick, &frame_timing);
+    uint64_t mark = monotonic_ns();
+    shown_frame = frame;
+    render_buffer(frame);
+    frame_timing.stage_ns[STAGE_UPLOAD] = lap_ns(&mark);
+    frame_timing.stage_ns[STAGE_DISPLAY] = mark - start;
+    timing_record(&timing, &frame_timing);
 
     // only print once per second
-    clock_t curtime = clock();
-    if ( curtime - lasttime >= CLOCKS_PER_SEC ){ 
+    const uint64_t curtime = mark;
+    if ( curtime - lasttime >= 1000000000ull ){ 
         printf("FPS: %d\r", (frame_count - lastframe));
         fflush(stdout);
         lastframe = frame_count;
@@ -414,7 +1060,66 @@ void display() {
 
 }
 
-int shutdown() {
+#ifndef KALEIDO_BENCH
+/// HEADLESS ///
+// No GLUT and no audio device: render ticks back to back as fast as the producer allows,
+// through the same synthesize_frame() as display(), pulling FPS worth of samples out of
+// the audio callback by hand after each one. Video is .y4m or else raw rgb24.
+static int run_headless(int frames, const char *video_path, const char *audio_path) {
+    const int samples_per_frame = SAMPLE_RATE / FPS;
+    float samples[2 * samples_per_frame]; // L, R
+    FILE *video = NULL, *audio = NULL;
+    const int y4m = video_path && ends_with(video_path, ".y4m");
+    if(video_path) {
+        video = fopen(video_path, "wb");
+        retfail(-(video == NULL));
+        if(y4m) {
+            retfail(write_y4m_header(video, WIDTH, HEIGHT, FPS));
+        }
+    }
+    if(audio_path) {
+        audio = fopen(audio_path, "wb");
+        retfail(-(audio == NULL));
+        retfail(write_wav_header(audio, 2, SAMPLE_RATE, 0));
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int tick=0; tick < frames; ++tick) {
+        frame_count = tick;
+        struct frame_timing frame_timing;
+        const uint64_t frame_start = monotonic_ns();
+        float *rgb = next_frame(tick, 1);
+        synthesize_frame(rgb, tick, &frame_timing);
+        if(video) {
+            retfail(y4m ? write_y4m_frame(video, rgb, WIDTH, HEIGHT) :
+                    write_raw_frame(video, rgb, WIDTH, HEIGHT));
+        }
+        if(audio) {
+            audio_callback(NULL, samples, samples_per_frame, NULL, 0, &audio_buf);
+            retfail(write_wav_samples(audio, samples, 2 * samples_per_frame));
+        }
+        frame_timing.stage_ns[STAGE_DISPLAY] = monotonic_ns() - frame_start;
+        timing_record(&timing, &frame_timing);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("Rendered %d frames in %.3fs: %.1f frames/s, %.2fx realtime\n",
+            frames, seconds, frames / seconds, frames / seconds / FPS);
+    timing_flush(&timing);
+
+    if(audio) {
+        retfail(wav_finish(audio, 2, SAMPLE_RATE, frames * samples_per_frame));
+        fclose(audio);
+    }
+    if(video) {
+        fclose(video);
+    }
+    return SUCCESS;
+}
+#endif
+
+int shutdown_audio() {
     retfail(Pa_StopStream( stream ));
     retfail(Pa_CloseStream( stream ));
     return SUCCESS;
@@ -423,7 +1128,7 @@ int shutdown() {
 void sighandler(int signo) {
     if (signo == SIGKILL || signo == SIGINT) {
         printf("Shutting down...");
-        shutdown();
+        shutdown_audio();
         exit(0);
     }
 }
@@ -431,9 +1136,9 @@ void sighandler(int signo) {
 int keyboard_callback(unsigned char key, int x, int y) {
     printf("Keypress: %d\n", key);
     if(key == 'R') { // Reseed
-        seed_network();
+        request_reseed();
     } else if (key == 27) { // escape
-        shutdown();
+        shutdown_audio();
         exit(0);
     } else if (key == 'a') {
         CLAMP_KEY = 0;
@@ -455,6 +1160,11 @@ int keyboard_callback(unsigned char key, int x, int y) {
         MELODY_ON = !MELODY_ON;
     } else if (key == 'B') {
         BEATS_ON = !BEATS_ON;
+    } else if (key == 'k') { // cycle kaleidoscope symmetries
+        SYMMETRY = (SYMMETRY + 1) % SYMMETRIES;
+    } else if (key == 'p') { // activation precision
+        ACTIVATION_PRECISION = ACTIVATION_PRECISION == ACTIVATE_FAST ?
+            ACTIVATE_EXACT : ACTIVATE_FAST;
     }
     return SUCCESS;
 }
@@ -462,22 +1172,49 @@ int keyboard_callback(unsigned char key, int x, int y) {
 void timer(int value) {
     glutPostRedisplay();
     glutTimerFunc(1000 / FPS, &timer, value);
-    frame_count ++;
-    if(frame_count > 60 * SECONDS) {
-        frame_count = 0;
-        seed_network();
-    }
+    frame_count ++; // the frame producer reseeds every CYCLE ticks
 }
 
-int main(int argc, char **argv) {
-    srand(time(NULL));
-    printf("Hello deepnet");
+// networks, inference threads, ffts and filters: everything but the producer and i/o
+static int init_pipeline() {
     retfail(init_neural_network());
+    retfail(pool_init(&nn_pool, pool_default_threads()));
+    printf("Inference threads: %d\n", nn_pool.threads);
     full_fftri_cfg = kiss_fftr_alloc(WIDTH * HEIGHT * COLOURS, 1, NULL,NULL);
     full_fftr_cfg = kiss_fftr_alloc(WIDTH * HEIGHT * COLOURS, 0, NULL,NULL);
     bar_fftri_cfg = kiss_fftr_alloc(BAR_LENGTH, 1, NULL,NULL);
     bar_fftr_cfg = kiss_fftr_alloc(BAR_LENGTH, 0, NULL,NULL);
+    retfail(pool_init(&effects_pool, pool_default_threads()));
+    retfail(init_harmonics());
+    return SUCCESS;
+}
+
+#ifndef KALEIDO_BENCH // kaleido_bench.c brings its own main
+// the windowed loop only ends in exit(), from escape, a signal or GLUT itself
+static void flush_timing() {
+    timing_flush(&timing);
+}
+
+int main(int argc, char **argv) {
+    const char *seed = getenv("KALEIDO_SEED");
+    SEED = seed ? strtoull(seed, NULL, 0) : (uint64_t) time(NULL);
+    printf("Hello deepnet, KALEIDO_SEED=%llu\n", (unsigned long long) SEED);
+    const char *rate = getenv("KALEIDO_RATE");
+    if(rate) {
+        NATIVE_RATE = strcmp(rate, "native") == 0;
+        SAMPLE_RATE = NATIVE_RATE ? SAMPLE_RATE : lrint(atof(rate)); // whole hertz
+        retfail(-(SAMPLE_RATE <= 0));
+    }
+    retfail(init_pipeline());
+    retfail(init_frame_queue());
+    retfail(timing_init(&timing, getenv("KALEIDO_TIMING"), stage_names, FRAME_STAGES));
+
+    // kaleidosynth --headless FRAMES [VIDEO.y4m|VIDEO.rgb] [AUDIO.wav]
+    if(argc >= 3 && strcmp(argv[1], "--headless") == 0) {
+        return run_headless(atoi(argv[2]), argc > 3 ? argv[3] : NULL, argc > 4 ? argv[4] : NULL);
+    }
 
+    retfail(atexit(flush_timing));
     printf("Hello sound\n");
     retfail(init_portaudio());
     retfail(signal(SIGINT, sighandler) == SIG_ERR);
@@ -485,6 +1222,8 @@ int main(int argc, char **argv) {
     retfail(Pa_StartStream(stream));
 
     printf("Hello video\n");
+    const char *texture = getenv("KALEIDO_TEXTURE"); // half for half float uploads
+    TEXTURE_FORMAT = texture && strcmp(texture, "half") == 0 ? TEXTURE_HALF : TEXTURE_RGBA8;
     retfail(init_display(argc, argv));
 
     glutDisplayFunc(&display);
@@ -494,3 +1233,4 @@ int main(int argc, char **argv) {
     glutMainLoop(); // never returns
     return SUCCESS;
 }
+#endif
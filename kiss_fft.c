@@ -18,6 +18,156 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
  fixed or floating point complex numbers.  It also delares the kf_ internal functions.
  */
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef KISS_FFT_DISPATCH
+#include <immintrin.h>
+
+/* AVX2 with FMA, 4 complex to a vector */
+#define KF_TARGET __attribute__((target("avx2,fma")))
+#define KF_W 4
+#define V(name) kf_##name##_avx2
+typedef __m256 kf_v_avx2;
+static inline KF_TARGET __m256i kf_mask_avx2(int n)
+{
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(2*n), _mm256_setr_epi32(0,1,2,3,4,5,6,7));
+}
+static inline KF_TARGET __m256 kf_load_avx2(const kiss_fft_cpx * p, int n)
+{
+    return n == KF_W ? _mm256_loadu_ps((const float *) p) : _mm256_maskload_ps((const float *) p, kf_mask_avx2(n));
+}
+static inline KF_TARGET void kf_store_avx2(kiss_fft_cpx * p, __m256 v, int n)
+{
+    if (n == KF_W)
+        _mm256_storeu_ps((float *) p, v);
+    else
+        _mm256_maskstore_ps((float *) p, kf_mask_avx2(n), v);
+}
+static inline KF_TARGET __m256 kf_add_avx2(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+static inline KF_TARGET __m256 kf_sub_avx2(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+static inline KF_TARGET __m256 kf_scale_avx2(__m256 a, float s) { return _mm256_mul_ps(a, _mm256_set1_ps(s)); }
+static inline KF_TARGET __m256 kf_cmul_avx2(__m256 a, __m256 b)
+{
+    return _mm256_fmaddsub_ps(a, _mm256_moveldup_ps(b), _mm256_mul_ps(_mm256_permute_ps(a, 0xb1), _mm256_movehdup_ps(b)));
+}
+static inline KF_TARGET __m256 kf_muli_avx2(__m256 a)
+{
+    return _mm256_addsub_ps(_mm256_setzero_ps(), _mm256_permute_ps(a, 0xb1));
+}
+static inline KF_TARGET __m256 kf_conj_avx2(__m256 a)
+{
+    return _mm256_xor_ps(a, _mm256_setr_ps(0,-0.f,0,-0.f,0,-0.f,0,-0.f));
+}
+static inline KF_TARGET __m256 kf_rev_avx2(__m256 a)
+{
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(a), 0x1b));
+}
+#include "_kiss_fft_simd.h"
+#undef KF_TARGET
+#undef KF_W
+#undef V
+
+/* AVX-512, 8 complex to a vector */
+#define KF_TARGET __attribute__((target("avx512f")))
+#define KF_W 8
+#define V(name) kf_##name##_avx512
+typedef __m512 kf_v_avx512;
+static inline KF_TARGET __m512 kf_load_avx512(const kiss_fft_cpx * p, int n)
+{
+    return n == KF_W ? _mm512_loadu_ps(p) : _mm512_maskz_loadu_ps((__mmask16) ((1u << 2*n) - 1), p);
+}
+static inline KF_TARGET void kf_store_avx512(kiss_fft_cpx * p, __m512 v, int n)
+{
+    if (n == KF_W)
+        _mm512_storeu_ps(p, v);
+    else
+        _mm512_mask_storeu_ps(p, (__mmask16) ((1u << 2*n) - 1), v);
+}
+static inline KF_TARGET __m512 kf_add_avx512(__m512 a, __m512 b) { return _mm512_add_ps(a, b); }
+static inline KF_TARGET __m512 kf_sub_avx512(__m512 a, __m512 b) { return _mm512_sub_ps(a, b); }
+static inline KF_TARGET __m512 kf_scale_avx512(__m512 a, float s) { return _mm512_mul_ps(a, _mm512_set1_ps(s)); }
+static inline KF_TARGET __m512 kf_cmul_avx512(__m512 a, __m512 b)
+{
+    return _mm512_fmaddsub_ps(a, _mm512_moveldup_ps(b), _mm512_mul_ps(_mm512_permute_ps(a, 0xb1), _mm512_movehdup_ps(b)));
+}
+static inline KF_TARGET __m512 kf_muli_avx512(__m512 a)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    return _mm512_fmaddsub_ps(zero, zero, _mm512_permute_ps(a, 0xb1));
+}
+static inline KF_TARGET __m512 kf_conj_avx512(__m512 a)
+{
+    return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a), _mm512_set1_epi64(0x8000000000000000ull)));
+}
+static inline KF_TARGET __m512 kf_rev_avx512(__m512 a)
+{
+    return _mm512_castpd_ps(_mm512_permutexvar_pd(_mm512_set_epi64(0,1,2,3,4,5,6,7), _mm512_castps_pd(a)));
+}
+#include "_kiss_fft_simd.h"
+#undef KF_TARGET
+#undef KF_W
+#undef V
+
+static int kf_simd_level(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return KF_SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return KF_SIMD_AVX2;
+    return KF_SIMD_NONE;
+}
+
+/* Lays out the stage twiddles past st->twiddles if st is not NULL, and returns how many
+   there are: [p-1][m] for each stage of a radix up to 5 and a sub-fft of KF_SIMD_MIN or
+   more. None at all when the cpu has no use for them. */
+static size_t kf_simd_twiddles(kiss_fft_cfg st, const int * factors, int nfft, int simd)
+{
+    size_t total = 0, fstride = 1;
+    int s = 0, m;
+    do {
+        const int p = factors[2*s];
+        m = factors[2*s+1];
+        if (st)
+            st->stage_twiddles[s] = NULL;
+        if (simd != KF_SIMD_NONE && p <= 5 && m >= KF_SIMD_MIN) {
+            if (st) {
+                kiss_fft_cpx * tw = st->twiddles + nfft + total;
+                int q, k;
+                for (q=1; q<p; ++q)
+                    for (k=0; k<m; ++k)
+                        tw[(q-1)*m + k] = st->twiddles[fstride*q*k];
+                st->stage_twiddles[s] = tw;
+            }
+            total += (size_t) (p-1) * m;
+        }
+        fstride *= p;
+        ++s;
+    } while (m > 1);
+    return total;
+}
+
+int kf_simd_split(const kiss_fft_cfg st,const kiss_fft_cpx *tmpbuf,const kiss_fft_cpx *super_twiddles,kiss_fft_cpx *freqdata)
+{
+    switch (st->simd) {
+        case KF_SIMD_AVX512: return kf_split_avx512(st->nfft, tmpbuf, super_twiddles, freqdata);
+        case KF_SIMD_AVX2: return kf_split_avx2(st->nfft, tmpbuf, super_twiddles, freqdata);
+        default: return 1;
+    }
+}
+
+int kf_simd_merge(const kiss_fft_cfg st,const kiss_fft_cpx *freqdata,const kiss_fft_cpx *super_twiddles,kiss_fft_cpx *tmpbuf)
+{
+    switch (st->simd) {
+        case KF_SIMD_AVX512: return kf_merge_avx512(st->nfft, freqdata, super_twiddles, tmpbuf);
+        case KF_SIMD_AVX2: return kf_merge_avx2(st->nfft, freqdata, super_twiddles, tmpbuf);
+        default: return 1;
+    }
+}
+#endif
+
 static void kf_bfly2(
         kiss_fft_cpx * Fout,
         const size_t fstride,
@@ -194,6 +344,49 @@ static void kf_bfly5(
     }
 }
 
+#ifdef KF_BLUESTEIN
+/* One length p transform of the generic butterfly by Bluestein's algorithm:
+   Fout[m*k] = sum_q Fout[m*q] W^(step*q) Wp^(q*k), with a of 2*bs->len scratch.
+   q*k = (q^2 + k^2 - (k-q)^2)/2, so it is the chirp times the convolution of the
+   chirped input with the conjugate chirp. */
+static void kf_bluestein(
+        kiss_fft_cpx * Fout,
+        int m,
+        int p,
+        size_t step,
+        const kiss_fft_cfg st,
+        const struct kf_bluestein * bs,
+        kiss_fft_cpx * a
+        )
+{
+    kiss_fft_cpx * A = a + bs->len;
+    kiss_fft_cpx t;
+    size_t twidx = 0;
+    int q, k;
+
+    for (q=0; q<p; ++q) {
+        C_MUL(t, Fout[q*m], st->twiddles[twidx]);
+        C_MUL(a[q], t, bs->chirp[q]);
+        twidx += step;
+        if (twidx >= (size_t) st->nfft) twidx -= st->nfft;
+    }
+    memset(a + p, 0, sizeof(kiss_fft_cpx)*(bs->len - p));
+    kiss_fft(bs->fft, a, A);
+    for (k=0; k<bs->len; ++k) {
+        C_MUL(t, A[k], bs->filter[k]);
+        A[k] = t;
+    }
+    kiss_fft(bs->ifft, A, a);
+    for (k=0; k<p; ++k)
+        C_MUL(Fout[k*m], a[k], bs->chirp[k]);
+}
+#endif
+
+/* Below KISS_FFT_BLUESTEIN_MIN the direct path's p points of scratch fit on the stack */
+#if KISS_FFT_BLUESTEIN_MIN <= 1024
+# define KF_GENERIC_STACK KISS_FFT_BLUESTEIN_MIN
+#endif
+
 /* perform the butterfly for one stage of a mixed radix FFT */
 static void kf_bfly_generic(
         kiss_fft_cpx * Fout,
@@ -208,7 +401,11 @@ static void kf_bfly_generic(
     kiss_fft_cpx t;
     int Norig = st->nfft;
 
+#ifdef KF_GENERIC_STACK
+    kiss_fft_cpx scratch[KF_GENERIC_STACK];
+#else
     kiss_fft_cpx * scratch = (kiss_fft_cpx*)KISS_FFT_TMP_ALLOC(sizeof(kiss_fft_cpx)*p);
+#endif
 
     for ( u=0; u<m; ++u ) {
         k=u;
@@ -231,7 +428,58 @@ static void kf_bfly_generic(
             k += m;
         }
     }
+#ifndef KF_GENERIC_STACK
     KISS_FFT_TMP_FREE(scratch);
+#endif
+}
+
+#ifdef KF_BLUESTEIN
+/* the generic butterfly of a stage planned for Bluestein, in the call's work */
+static void kf_bfly_bluestein(
+        kiss_fft_cpx * Fout,
+        const size_t fstride,
+        const kiss_fft_cfg st,
+        int m,
+        int p,
+        const struct kf_bluestein * bs,
+        kiss_fft_cpx * work
+        )
+{
+    int u;
+    for ( u=0; u<m; ++u )
+        kf_bluestein(Fout + u, m, p, fstride*u, st, bs, work);
+}
+#endif
+
+/* Recombine with whichever butterfly fits p, vectorized where the stage has twiddles
+   laid out for it. */
+static void kf_bfly(kiss_fft_cpx * Fout, const size_t fstride, const kiss_fft_cfg st, int m, int p, int stage, kiss_fft_cpx * work)
+{
+#ifdef KISS_FFT_DISPATCH
+    const kiss_fft_cpx * tw = st->stage_twiddles[stage];
+    if (tw) {
+        if (st->simd == KF_SIMD_AVX512)
+            kf_bfly_avx512(Fout,fstride,st,m,p,tw);
+        else
+            kf_bfly_avx2(Fout,fstride,st,m,p,tw);
+        return;
+    }
+#endif
+    switch (p) {
+        case 2: kf_bfly2(Fout,fstride,st,m); break;
+        case 3: kf_bfly3(Fout,fstride,st,m); break; 
+        case 4: kf_bfly4(Fout,fstride,st,m); break;
+        case 5: kf_bfly5(Fout,fstride,st,m); break; 
+        default:
+#ifdef KF_BLUESTEIN
+            if (st->bluestein[stage]) {
+                kf_bfly_bluestein(Fout,fstride,st,m,p,st->bluestein[stage],work);
+                break;
+            }
+#endif
+            kf_bfly_generic(Fout,fstride,st,m,p);
+            break;
+    }
 }
 
 static
@@ -241,10 +489,12 @@ void kf_work(
         const size_t fstride,
         int in_stride,
         int * factors,
-        const kiss_fft_cfg st
+        const kiss_fft_cfg st,
+        kiss_fft_cpx * work
         )
 {
     kiss_fft_cpx * Fout_beg=Fout;
+    const int stage=(factors - st->factors) / 2;
     const int p=*factors++; /* the radix  */
     const int m=*factors++; /* stage's fft length/p */
     const kiss_fft_cpx * Fout_end = Fout + p*m;
@@ -252,23 +502,19 @@ void kf_work(
 #ifdef _OPENMP
     // use openmp extensions at the 
     // top-level (not recursive)
-    if (fstride==1 && p<=5)
+    if (fstride==1 && p<=5 && !st->nested)
     {
         int k;
 
-        // execute the p different work units in different threads
+        // execute the p different work units in different threads,
+        // each with its own slice of kf_work_alloc's scratch
 #       pragma omp parallel for
         for (k=0;k<p;++k) 
-            kf_work( Fout +k*m, f+ fstride*in_stride*k,fstride*p,in_stride,factors,st);
+            kf_work( Fout +k*m, f+ fstride*in_stride*k,fstride*p,in_stride,factors,st,
+                    work ? work + (size_t)k*st->bluestein_work : NULL);
         // all threads have joined by this point
 
-        switch (p) {
-            case 2: kf_bfly2(Fout,fstride,st,m); break;
-            case 3: kf_bfly3(Fout,fstride,st,m); break; 
-            case 4: kf_bfly4(Fout,fstride,st,m); break;
-            case 5: kf_bfly5(Fout,fstride,st,m); break; 
-            default: kf_bfly_generic(Fout,fstride,st,m,p); break;
-        }
+        kf_bfly(Fout,fstride,st,m,p,stage,work);
         return;
     }
 #endif
@@ -284,7 +530,7 @@ void kf_work(
             // DFT of size m*p performed by doing
             // p instances of smaller DFTs of size m, 
             // each one takes a decimated version of the input
-            kf_work( Fout , f, fstride*p, in_stride, factors,st);
+            kf_work( Fout , f, fstride*p, in_stride, factors,st,work);
             f += fstride*in_stride;
         }while( (Fout += m) != Fout_end );
     }
@@ -292,15 +538,265 @@ void kf_work(
     Fout=Fout_beg;
 
     // recombine the p smaller DFTs 
-    switch (p) {
-        case 2: kf_bfly2(Fout,fstride,st,m); break;
-        case 3: kf_bfly3(Fout,fstride,st,m); break; 
-        case 4: kf_bfly4(Fout,fstride,st,m); break;
-        case 5: kf_bfly5(Fout,fstride,st,m); break; 
-        default: kf_bfly_generic(Fout,fstride,st,m,p); break;
+    kf_bfly(Fout,fstride,st,m,p,stage,work);
+}
+
+/* kf_work for an input that is zero but for idx[0..count), which are indices into the
+ * whole of fin. This sub-fft's inputs are fin[offset + fstride*j]. idx gets reordered so
+ * that each of the p decimated sub-sequences finds its own indices in one run. */
+static
+void kf_work_sparse(
+        kiss_fft_cpx * Fout,
+        const kiss_fft_cpx * fin,
+        size_t offset,
+        const size_t fstride,
+        int * factors,
+        const kiss_fft_cfg st,
+        int * idx,
+        int count,
+        kiss_fft_cpx * work
+        )
+{
+    const int stage=(factors - st->factors) / 2;
+    const int p=*factors++; /* the radix  */
+    const int m=*factors++; /* stage's fft length/p */
+    int q, i, start=0;
+
+    if (count == 0) {
+        /* nothing but zeros in, nothing but zeros out */
+        memset(Fout, 0, sizeof(kiss_fft_cpx)*p*m);
+        return;
+    }
+
+    if (m==1) {
+        memset(Fout, 0, sizeof(kiss_fft_cpx)*p);
+        for (i=0; i<count; ++i)
+            Fout[(idx[i] - offset) / fstride] = fin[idx[i]];
+    }else{
+        for (q=0; q<p; ++q) {
+            int end = start;
+            for (i=start; i<count; ++i) {
+                if ((idx[i] - offset) / fstride % p == (size_t) q) {
+                    int t = idx[end];
+                    idx[end++] = idx[i];
+                    idx[i] = t;
+                }
+            }
+            kf_work_sparse( Fout + q*m, fin, offset + q*fstride, fstride*p, factors, st,
+                    idx + start, end - start, work);
+            start = end;
+        }
+    }
+
+    kf_bfly(Fout,fstride,st,m,p,stage,work);
+}
+
+static int kf_compare_int(const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+/* sort and drop repeats, returns how many are left */
+static int kf_unique(int * v, int count)
+{
+    int i, n = 0;
+    qsort(v, count, sizeof(int), kf_compare_int);
+    for (i=0; i<count; ++i)
+        if (n == 0 || v[n-1] != v[i])
+            v[n++] = v[i];
+    return n;
+}
+
+/* kf_work computing only Fout[want[depth][0..count[depth])]. Every sub-fft at a depth
+ * wants the same indices, the parent's mod its length. From depth full down, where that
+ * is a good part of each sub-fft anyway, they are computed whole. */
+static
+void kf_work_pruned(
+        kiss_fft_cpx * Fout,
+        const kiss_fft_cpx * f,
+        const size_t fstride,
+        int * factors,
+        const kiss_fft_cfg st,
+        int want[][KISS_FFT_PRUNE_MAX],
+        const int * count,
+        int depth,
+        int full,
+        kiss_fft_cpx * scratch,
+        kiss_fft_cpx * work
+        )
+{
+    const int p=factors[0];
+    const int m=factors[1];
+    const int * w = want[depth];
+    int q, i;
+
+    if (depth == full) {
+        kf_work(Fout, f, fstride, 1, factors, st, work);
+        return;
+    }
+
+    for (q=0; q<p; ++q)
+        kf_work_pruned( Fout + q*m, f + q*fstride, fstride*p, factors + 2, st, want, count,
+                depth + 1, full, scratch, work);
+
+    /* the butterfly at each wanted output, all read before any is written */
+    for (i=0; i<count[depth]; ++i) {
+        const int u = w[i] % m;
+        kiss_fft_cpx t, sum = Fout[u];
+        for (q=1; q<p; ++q) {
+            const size_t twidx = (size_t) fstride * q * w[i] % st->nfft;
+            C_MUL(t, Fout[q*m + u], st->twiddles[twidx]);
+            C_ADDTO(sum, t);
+        }
+        scratch[i] = sum;
+    }
+    for (i=0; i<count[depth]; ++i)
+        Fout[w[i]] = scratch[i];
+}
+
+/* r for n = r*c four step, or 0 if no r is at least KISS_FFT_FOURSTEP_SPLIT */
+static int kf_fourstep_factor(int n)
+{
+    int r;
+    for (r = (int) floor(sqrt((double)n)); n % r; --r)
+        ;
+    return r >= KISS_FFT_FOURSTEP_SPLIT ? r : 0;
+}
+
+/* kf_fourstep_factor, where kiss_fft_alloc is to use four step: never unless built with
+   KISS_FFT_FOURSTEP_MIN and threads to spread over */
+static int kf_fourstep_split(int n)
+{
+#ifdef _OPENMP
+    if (KISS_FFT_FOURSTEP_MIN > 0 && n >= KISS_FFT_FOURSTEP_MIN && omp_get_max_threads() > 1)
+        return kf_fourstep_factor(n);
+#endif
+    (void)n;
+    return 0;
+}
+
+/* Four step transform of fin, read every in_stride, as an r x c matrix in[i + r*j]:
+   each of its r rows transformed along j into row i of scratch and twiddled by
+   W^(i*k), then the c columns of scratch transformed along i into fout[c*l + k].
+   Consecutive rows read neighbouring entries, so a row's worth of cache lines serves
+   them all, and columns go KF_FOURSTEP_BLOCK at a time so that their writes fill
+   whole lines of fout. */
+#define KF_FOURSTEP_BLOCK 8
+static void kf_fourstep(kiss_fft_cfg st,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,int in_stride)
+{
+    const int r = st->cols->nfft;
+    const int c = st->rows->nfft;
+    /* the r x c matrix between the passes, per call so that a cfg can be shared, and from
+       the heap: it is as large as the transform */
+    kiss_fft_cpx * scratch = (kiss_fft_cpx*)KISS_FFT_MALLOC(sizeof(kiss_fft_cpx)*st->nfft);
+
+#ifdef _OPENMP
+#   pragma omp parallel if (!st->nested)
+#endif
+    {
+        kiss_fft_cpx * lines = (kiss_fft_cpx*)KISS_FFT_TMP_ALLOC(sizeof(kiss_fft_cpx)*r*KF_FOURSTEP_BLOCK);
+        int i, k, l;
+
+#ifdef _OPENMP
+#       pragma omp for
+#endif
+        for (i=0; i<r; ++i) {
+            kiss_fft_cpx * row = scratch + (size_t)i*c;
+            const kiss_fft_cpx * tw = st->fourstep_twiddles + (size_t)i*c;
+            kiss_fft_cpx t;
+            kiss_fft_stride(st->rows, fin + (size_t)i*in_stride, row, r*in_stride);
+            for (k=1; k<c; ++k) {
+                C_MUL(t, row[k], tw[k]);
+                row[k] = t;
+            }
+        }
+
+#ifdef _OPENMP
+#       pragma omp for
+#endif
+        for (k=0; k<c; k+=KF_FOURSTEP_BLOCK) {
+            const int b = c - k < KF_FOURSTEP_BLOCK ? c - k : KF_FOURSTEP_BLOCK;
+            int j;
+            for (j=0; j<b; ++j)
+                kiss_fft_stride(st->cols, scratch + k + j, lines + (size_t)j*r, c);
+            for (l=0; l<r; ++l)
+                for (j=0; j<b; ++j)
+                    fout[(size_t)c*l + k + j] = lines[(size_t)j*r + l];
+        }
+
+        KISS_FFT_TMP_FREE(lines);
+    }
+    KISS_FFT_FREE(scratch);
+}
+
+#ifdef KF_BLUESTEIN
+static void kf_bluestein_init(struct kf_bluestein * bs, int p, int inverse_fft)
+{
+    const double pi=3.141592653589793238462643383279502884197169399375105820974944;
+    int n;
+    for (n=0; n<p; ++n) {
+        /* W^(n*n/2), n*n taken mod 2p while it is still exact */
+        double phase = -pi * (double)((long long)n*n % (2*p)) / p;
+        if (inverse_fft)
+            phase *= -1;
+        kf_cexp(bs->chirp+n, phase);
+    }
+    memset(bs->filter, 0, sizeof(kiss_fft_cpx)*bs->len);
+    for (n=0; n<p; ++n) {
+        kiss_fft_cpx b;
+        b.r = bs->chirp[n].r / bs->len;
+        b.i = -bs->chirp[n].i / bs->len;
+        bs->filter[n] = b;
+        if (n)
+            bs->filter[bs->len - n] = b;
     }
+    kiss_fft(bs->fft, bs->filter, bs->filter);
 }
 
+static kiss_fft_cfg kf_alloc(int nfft,int inverse_fft,int r,void * mem,size_t * lenmem);
+
+/* Bluestein plans for the stages of a prime radix from KISS_FFT_BLUESTEIN_MIN up,
+   laid out from base if st is not NULL, and st's bluestein_work. Their convolutions
+   are plain recursions: on the calling thread four step would only add a pass. Returns
+   the bytes they take. */
+static size_t kf_bluestein_plans(kiss_fft_cfg st, const int * factors, int inverse_fft, char * base)
+{
+    size_t used = 0;
+    int s = 0, m;
+    if (st)
+        st->bluestein_work = 0;
+    do {
+        const int p = factors[2*s];
+        m = factors[2*s+1];
+        if (st)
+            st->bluestein[s] = NULL;
+        if (p >= KISS_FFT_BLUESTEIN_MIN) {
+            const int len = kiss_fft_next_fast_size(2*p - 1);
+            size_t fftsize = 0;
+            kf_alloc(len,0,0,NULL,&fftsize);
+            if (st) {
+                struct kf_bluestein * bs = (struct kf_bluestein *)(base + used);
+                bs->len = len;
+                bs->chirp = (kiss_fft_cpx *)(bs + 1);
+                bs->filter = bs->chirp + p;
+                bs->fft = (kiss_fft_cfg)(bs->filter + len);
+                bs->ifft = (kiss_fft_cfg)((char*)bs->fft + fftsize);
+                kf_alloc(len,0,0,bs->fft,&fftsize);
+                kf_alloc(len,1,0,bs->ifft,&fftsize);
+                bs->fft->nested = bs->ifft->nested = 1;
+                kf_bluestein_init(bs, p, inverse_fft);
+                st->bluestein[s] = bs;
+                if (2*len > st->bluestein_work)
+                    st->bluestein_work = 2*len;
+            }
+            used += sizeof(struct kf_bluestein) + sizeof(kiss_fft_cpx)*(p + len) + 2*fftsize;
+        }
+        ++s;
+    } while (m > 1);
+    return used;
+}
+#endif
+
 /*  facbuf is populated by p1,m1,p2,m2, ...
     where 
     p[i] * m[i] = m[i-1]
@@ -336,11 +832,32 @@ void kf_factor(int n,int * facbuf)
  * The return value is a contiguous block of memory, allocated with malloc.  As such,
  * It can be freed with free(), rather than a kiss_fft-specific function.
  * */
-kiss_fft_cfg kiss_fft_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem )
+/* kiss_fft_alloc, four step as r*(nfft/r) unless r is 0 */
+static kiss_fft_cfg kf_alloc(int nfft,int inverse_fft,int r,void * mem,size_t * lenmem )
 {
     kiss_fft_cfg st=NULL;
+    int factors[2*MAXFACTORS];
     size_t memneeded = sizeof(struct kiss_fft_state)
         + sizeof(kiss_fft_cpx)*(nfft-1); /* twiddle factors*/
+#ifdef KISS_FFT_DISPATCH
+    const int simd = kf_simd_level();
+#endif
+
+    size_t rowsize = 0, colsize = 0, stagesize = 0, plansize = 0;
+
+    kf_factor(nfft,factors);
+#ifdef KISS_FFT_DISPATCH
+    stagesize = kf_simd_twiddles(NULL,factors,nfft,simd);
+#endif
+    if (r) {
+        kiss_fft_alloc(nfft/r,inverse_fft,NULL,&rowsize);
+        kiss_fft_alloc(r,inverse_fft,NULL,&colsize);
+    }
+    memneeded += sizeof(kiss_fft_cpx)*(stagesize + (r ? (size_t)nfft : 0)) + rowsize + colsize;
+#ifdef KF_BLUESTEIN
+    plansize = kf_bluestein_plans(NULL,factors,inverse_fft,NULL);
+#endif
+    memneeded += plansize;
 
     if ( lenmem==NULL ) {
         st = ( kiss_fft_cfg)KISS_FFT_MALLOC( memneeded );
@@ -353,6 +870,7 @@ kiss_fft_cfg kiss_fft_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem
         int i;
         st->nfft=nfft;
         st->inverse = inverse_fft;
+        st->nested = 0;
 
         for (i=0;i<nfft;++i) {
             const double pi=3.141592653589793238462643383279502884197169399375105820974944;
@@ -362,24 +880,84 @@ kiss_fft_cfg kiss_fft_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem
             kf_cexp(st->twiddles+i, phase );
         }
 
-        kf_factor(nfft,st->factors);
+        memcpy(st->factors,factors,sizeof(factors));
+#ifdef KISS_FFT_DISPATCH
+        st->simd = simd;
+        kf_simd_twiddles(st,factors,nfft,simd);
+#endif
+
+        st->rows = st->cols = NULL;
+        if (r) {
+            /* past the twiddles, and the stage twiddles if any */
+            const int c = nfft/r;
+            int j, k;
+            st->fourstep_twiddles = st->twiddles + nfft + stagesize;
+            st->rows = (kiss_fft_cfg)(st->fourstep_twiddles + nfft);
+            st->cols = (kiss_fft_cfg)((char*)st->rows + rowsize);
+            kiss_fft_alloc(c,inverse_fft,st->rows,&rowsize);
+            kiss_fft_alloc(r,inverse_fft,st->cols,&colsize);
+            for (j=0; j<r; ++j)
+                for (k=0; k<c; ++k)
+                    st->fourstep_twiddles[(size_t)j*c + k] = st->twiddles[j*k];
+        }
+
+        /* and last of all the Bluestein plans */
+#ifdef KF_BLUESTEIN
+        kf_bluestein_plans(st,factors,inverse_fft,(char*)st + memneeded - plansize);
+#else
+        st->bluestein_work = 0;
+#endif
     }
     return st;
 }
 
+kiss_fft_cfg kiss_fft_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem )
+{
+    return kf_alloc(nfft,inverse_fft,kf_fourstep_split(nfft),mem,lenmem);
+}
+
+kiss_fft_cfg kiss_fft_alloc_fourstep(int nfft,int inverse_fft,void * mem,size_t * lenmem )
+{
+    return kf_alloc(nfft,inverse_fft,kf_fourstep_factor(nfft),mem,lenmem);
+}
+
+
+/* The Bluestein stages' scratch for one call, from the heap however large: a slice of
+   bluestein_work points for each thread kf_work forks at the top, or NULL if no stage
+   needs any. */
+static kiss_fft_cpx * kf_work_alloc(const kiss_fft_cfg st)
+{
+    size_t slices = 1;
+    if (st->bluestein_work == 0)
+        return NULL;
+#ifdef _OPENMP
+    if (st->factors[0] <= 5 && !st->nested)
+        slices = st->factors[0];
+#endif
+    return (kiss_fft_cpx*)KISS_FFT_MALLOC(sizeof(kiss_fft_cpx)*st->bluestein_work*slices);
+}
 
 void kiss_fft_stride(kiss_fft_cfg st,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,int in_stride)
 {
+    kiss_fft_cpx * work;
+    if (st->cols) {
+        /* out of place through its own scratch already */
+        kf_fourstep(st,fin,fout,in_stride);
+        return;
+    }
+    work = kf_work_alloc(st);
     if (fin == fout) {
         //NOTE: this is not really an in-place FFT algorithm.
         //It just performs an out-of-place FFT into a temp buffer
         kiss_fft_cpx * tmpbuf = (kiss_fft_cpx*)KISS_FFT_TMP_ALLOC( sizeof(kiss_fft_cpx)*st->nfft);
-        kf_work(tmpbuf,fin,1,in_stride, st->factors,st);
+        kf_work(tmpbuf,fin,1,in_stride, st->factors,st,work);
         memcpy(fout,tmpbuf,sizeof(kiss_fft_cpx)*st->nfft);
         KISS_FFT_TMP_FREE(tmpbuf);
     }else{
-        kf_work( fout, fin, 1,in_stride, st->factors,st );
+        kf_work( fout, fin, 1,in_stride, st->factors,st,work );
     }
+    if (work)
+        KISS_FFT_FREE(work);
 }
 
 void kiss_fft(kiss_fft_cfg cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *fout)
@@ -388,6 +966,49 @@ void kiss_fft(kiss_fft_cfg cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *fout)
 }
 
 
+void kiss_fft_sparse(kiss_fft_cfg st,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,const int *nonzero,int count)
+{
+    int stack[KISS_FFT_PRUNE_MAX];
+    int * idx = count <= KISS_FFT_PRUNE_MAX ? stack : (int*)KISS_FFT_MALLOC(sizeof(int)*count);
+    kiss_fft_cpx * work = kf_work_alloc(st);
+    memcpy(idx, nonzero, sizeof(int)*count);
+    kf_work_sparse(fout, fin, 0, 1, st->factors, st, idx, count, work);
+    if (idx != stack)
+        KISS_FFT_FREE(idx);
+    if (work)
+        KISS_FFT_FREE(work);
+}
+
+void kiss_fft_pruned(kiss_fft_cfg st,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,const int *wanted,int count)
+{
+    int want[MAXFACTORS][KISS_FFT_PRUNE_MAX];
+    int counts[MAXFACTORS];
+    kiss_fft_cpx scratch[KISS_FFT_PRUNE_MAX];
+    kiss_fft_cpx * work;
+    int depth = 0, size = st->nfft;
+
+    if (count > KISS_FFT_PRUNE_MAX) {
+        kiss_fft(st, fin, fout);
+        return;
+    }
+    memcpy(want[0], wanted, sizeof(int)*count);
+    counts[0] = kf_unique(want[0], count);
+    /* prune while the wanted outputs are under a quarter of each sub-fft */
+    while (st->factors[2*depth+1] > 1 && 4*counts[depth] < size) {
+        const int m = st->factors[2*depth+1];
+        int i;
+        for (i=0; i<counts[depth]; ++i)
+            want[depth+1][i] = want[depth][i] % m;
+        counts[depth+1] = kf_unique(want[depth+1], counts[depth]);
+        size = m;
+        ++depth;
+    }
+    work = kf_work_alloc(st);
+    kf_work_pruned(fout, fin, 1, st->factors, st, want, counts, 0, depth, scratch, work);
+    if (work)
+        KISS_FFT_FREE(work);
+}
+
 void kiss_fft_cleanup(void)
 {
     // nothing needed any more
@@ -45,6 +45,7 @@ extern "C" {
 # ifndef kiss_fft_scalar
 /*  default is float */
 #   define kiss_fft_scalar float
+#   define KISS_FFT_SCALAR_FLOAT
 # endif
 #endif
 
@@ -97,6 +98,51 @@ void kiss_fft(kiss_fft_cfg cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *fout);
  * */
 void kiss_fft_stride(kiss_fft_cfg cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,int fin_stride);
 
+/*
+ Pruned transforms, for spectra that are mostly zero or mostly unwanted.
+
+ kiss_fft_sparse only reads fin at the count indices in nonzero (any order, no repeats),
+ the rest of fin counts as zero, and sub-transforms of nothing but zeros are skipped.
+
+ kiss_fft_pruned only computes fout at the count indices in wanted (any order, repeats
+ are fine); the rest of fout is left as scratch. Past KISS_FFT_PRUNE_MAX indices it is
+ plain kiss_fft.
+
+ For both, fin and fout must not overlap.
+ * */
+#define KISS_FFT_PRUNE_MAX 256
+void kiss_fft_sparse(kiss_fft_cfg cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,const int *nonzero,int count);
+void kiss_fft_pruned(kiss_fft_cfg cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,const int *wanted,int count);
+
+/*
+ kiss_fft_alloc_fourstep sets up a four step transform when nfft = r*c with r the
+ largest factor up to sqrt(nfft) and at least KISS_FFT_FOURSTEP_SPLIT: r transforms of
+ length c, a twiddle, then c of length r, each small enough to stay in cache and spread
+ over the OpenMP threads. Each call mallocs an nfft sized matrix between the passes.
+ On a single thread the plain recursion is the faster of the two, and where four step
+ starts to win on several cores hasn't been measured, so kiss_fft_alloc never picks it
+ on its own. Build with -DKISS_FFT_FOURSTEP_MIN=n to have it do so from n points up,
+ in OpenMP builds running more than one thread.
+ */
+#ifndef KISS_FFT_FOURSTEP_MIN
+# define KISS_FFT_FOURSTEP_MIN 0 /* off */
+#endif
+#define KISS_FFT_FOURSTEP_SPLIT 16
+kiss_fft_cfg kiss_fft_alloc_fourstep(int nfft,int inverse_fft,void * mem,size_t * lenmem);
+
+/*
+ Prime factors of nfft from KISS_FFT_BLUESTEIN_MIN up are done with Bluestein's
+ algorithm, in O(p log p) rather than O(p^2), in float builds. Each call takes its
+ convolutions' scratch from the heap once, sized for the largest such stage, so cfgs
+ stay safe to share between threads.
+ */
+#if defined(FIXED_POINT) || defined(USE_SIMD)
+# undef KISS_FFT_BLUESTEIN_MIN
+# define KISS_FFT_BLUESTEIN_MIN INT_MAX
+#elif !defined(KISS_FFT_BLUESTEIN_MIN)
+# define KISS_FFT_BLUESTEIN_MIN 59
+#endif
+
 /* If kiss_fft_alloc allocated a buffer, it is one contiguous 
    buffer and can be simply free()d when no longer needed*/
 #define kiss_fft_free free
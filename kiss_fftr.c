@@ -102,7 +102,11 @@ void kiss_fftr(kiss_fftr_cfg st,const kiss_fft_scalar *timedata,kiss_fft_cpx *fr
     freqdata[ncfft].i = freqdata[0].i = 0;
 #endif
 
-    for ( k=1;k <= ncfft/2 ; ++k ) {
+    k = 1;
+#ifdef KISS_FFT_DISPATCH
+    k = kf_simd_split(st->substate, st->tmpbuf, st->super_twiddles, freqdata);
+#endif
+    for ( ;k <= ncfft/2 ; ++k ) {
         fpk    = st->tmpbuf[k]; 
         fpnk.r =   st->tmpbuf[ncfft-k].r;
         fpnk.i = - st->tmpbuf[ncfft-k].i;
@@ -136,7 +140,11 @@ void kiss_fftri(kiss_fftr_cfg st,const kiss_fft_cpx *freqdata,kiss_fft_scalar *t
     st->tmpbuf[0].i = freqdata[0].r - freqdata[ncfft].r;
     C_FIXDIV(st->tmpbuf[0],2);
 
-    for (k = 1; k <= ncfft / 2; ++k) {
+    k = 1;
+#ifdef KISS_FFT_DISPATCH
+    k = kf_simd_merge(st->substate, freqdata, st->super_twiddles, st->tmpbuf);
+#endif
+    for (; k <= ncfft / 2; ++k) {
         kiss_fft_cpx fk, fnkc, fek, fok, tmp;
         fk = freqdata[k];
         fnkc.r = freqdata[ncfft - k].r;
@@ -157,3 +165,147 @@ void kiss_fftri(kiss_fftr_cfg st,const kiss_fft_cpx *freqdata,kiss_fft_scalar *t
     }
     kiss_fft (st->substate, st->tmpbuf, (kiss_fft_cpx *) timedata);
 }
+
+static int kf_listed(const int *bins, int count, int bin)
+{
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (bins[mid] < bin)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < count && bins[lo] == bin;
+}
+
+void kiss_fftr_bins(kiss_fftr_cfg st,const kiss_fft_scalar *timedata,kiss_fft_cpx *freqdata,const int *bins,int count)
+{
+    int want[KISS_FFT_PRUNE_MAX] = {0};
+    int i, k, ncfft, wanted = 0;
+    kiss_fft_cpx fpnk,fpk,f1k,f2k,tw,tdc;
+
+    if ( st->substate->inverse) {
+        fprintf(stderr,"kiss fft usage error: improper alloc\n");
+        exit(1);
+    }
+    if (2 * count > KISS_FFT_PRUNE_MAX) {
+        kiss_fftr(st, timedata, freqdata);
+        return;
+    }
+
+    ncfft = st->substate->nfft;
+
+    /* bin k of the real transform comes from bins k and ncfft-k of the packed one */
+    for (i = 0; i < count; ++i) {
+        want[wanted++] = bins[i] % ncfft;
+        want[wanted++] = (ncfft - bins[i]) % ncfft;
+    }
+    kiss_fft_pruned( st->substate , (const kiss_fft_cpx*)timedata, st->tmpbuf, want, wanted );
+
+    for (i = 0; i < count; ++i) {
+        const int bin = bins[i];
+        if (bin == 0 || bin == ncfft) {
+            tdc.r = st->tmpbuf[0].r;
+            tdc.i = st->tmpbuf[0].i;
+            C_FIXDIV(tdc,2);
+            freqdata[bin].r = bin == 0 ? tdc.r + tdc.i : tdc.r - tdc.i;
+#ifdef USE_SIMD    
+            freqdata[bin].i = _mm_set1_ps(0);
+#else
+            freqdata[bin].i = 0;
+#endif
+            continue;
+        }
+
+        /* as in kiss_fftr, which writes bin ncfft/2 twice, the second time as ncfft-k */
+        k = bin < ncfft - bin ? bin : ncfft - bin;
+        fpk    = st->tmpbuf[k]; 
+        fpnk.r =   st->tmpbuf[ncfft-k].r;
+        fpnk.i = - st->tmpbuf[ncfft-k].i;
+        C_FIXDIV(fpk,2);
+        C_FIXDIV(fpnk,2);
+
+        C_ADD( f1k, fpk , fpnk );
+        C_SUB( f2k, fpk , fpnk );
+        C_MUL( tw , f2k , st->super_twiddles[k-1]);
+
+        if (bin == k && 2 * k != ncfft) {
+            freqdata[k].r = HALF_OF(f1k.r + tw.r);
+            freqdata[k].i = HALF_OF(f1k.i + tw.i);
+        } else {
+            freqdata[ncfft-k].r = HALF_OF(f1k.r - tw.r);
+            freqdata[ncfft-k].i = HALF_OF(tw.i - f1k.i);
+        }
+    }
+}
+
+void kiss_fftri_bins(kiss_fftr_cfg st,const kiss_fft_cpx *freqdata,const int *bins,int count,kiss_fft_scalar *timedata)
+{
+    int nonzero[KISS_FFT_PRUNE_MAX];
+    int i, k, ncfft, n = 0;
+    const int sparse = 2 * count <= KISS_FFT_PRUNE_MAX;
+    kiss_fft_cpx zero;
+
+    if (st->substate->inverse == 0) {
+        fprintf (stderr, "kiss fft usage error: improper alloc\n");
+        exit (1);
+    }
+
+    ncfft = st->substate->nfft;
+#ifdef USE_SIMD
+    zero.r = zero.i = _mm_set1_ps(0);
+#else
+    zero.r = zero.i = 0;
+#endif
+    if (!sparse)
+        memset(st->tmpbuf, 0, sizeof(kiss_fft_cpx) * ncfft);
+
+    /* kiss_fftri's packing, one pair of bins at a time and a missing bin as zero */
+    for (i = 0; i < count; ++i) {
+        const int bin = bins[i];
+        kiss_fft_cpx fk, fnkc, fek, fok, tmp;
+        if (bin == 0 || bin == ncfft) {
+            if (bin == ncfft && kf_listed(bins, count, 0))
+                continue; /* already packed with bin 0 */
+            fk = kf_listed(bins, count, 0) ? freqdata[0] : zero;
+            fnkc = kf_listed(bins, count, ncfft) ? freqdata[ncfft] : zero;
+            st->tmpbuf[0].r = fk.r + fnkc.r;
+            st->tmpbuf[0].i = fk.r - fnkc.r;
+            C_FIXDIV(st->tmpbuf[0],2);
+            if (sparse)
+                nonzero[n++] = 0;
+            continue;
+        }
+
+        k = bin < ncfft - bin ? bin : ncfft - bin;
+        if (bin != k && kf_listed(bins, count, k))
+            continue; /* already packed with its mirror */
+        fk = kf_listed(bins, count, k) ? freqdata[k] : zero;
+        fnkc = kf_listed(bins, count, ncfft - k) ? freqdata[ncfft - k] : zero;
+        fnkc.i = -fnkc.i;
+        C_FIXDIV( fk , 2 );
+        C_FIXDIV( fnkc , 2 );
+
+        C_ADD (fek, fk, fnkc);
+        C_SUB (tmp, fk, fnkc);
+        C_MUL (fok, tmp, st->super_twiddles[k-1]);
+        C_ADD (st->tmpbuf[k],     fek, fok);
+        C_SUB (st->tmpbuf[ncfft - k], fek, fok);
+#ifdef USE_SIMD        
+        st->tmpbuf[ncfft - k].i *= _mm_set1_ps(-1.0);
+#else
+        st->tmpbuf[ncfft - k].i *= -1;
+#endif
+        if (sparse) {
+            nonzero[n++] = k;
+            if (ncfft - k != k)
+                nonzero[n++] = ncfft - k;
+        }
+    }
+
+    if (sparse)
+        kiss_fft_sparse (st->substate, st->tmpbuf, (kiss_fft_cpx *) timedata, nonzero, n);
+    else
+        kiss_fft (st->substate, st->tmpbuf, (kiss_fft_cpx *) timedata);
+}
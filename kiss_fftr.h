@@ -38,6 +38,18 @@ void kiss_fftri(kiss_fftr_cfg cfg,const kiss_fft_cpx *freqdata,kiss_fft_scalar *
  output timedata has nfft scalar points
 */
 
+void kiss_fftr_bins(kiss_fftr_cfg cfg,const kiss_fft_scalar *timedata,kiss_fft_cpx *freqdata,const int *bins,int count);
+/*
+ kiss_fftr, but only the count bins (ascending, in [0, nfft/2]) of freqdata are computed;
+ the rest of freqdata is left alone
+*/
+
+void kiss_fftri_bins(kiss_fftr_cfg cfg,const kiss_fft_cpx *freqdata,const int *bins,int count,kiss_fft_scalar *timedata);
+/*
+ kiss_fftri of a spectrum that is zero but for the count bins (ascending, in [0, nfft/2]),
+ the only ones of freqdata that are read
+*/
+
 #define kiss_fftr_free free
 
 #ifdef __cplusplus
@@ -0,0 +1,104 @@
+#ifndef MEDIA_H
+#define MEDIA_H
+/* Just enough of Y4M, raw rgb24 and float WAV to get frames and audio out of the
+ * headless renderer and into ffmpeg. */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "err.h"
+
+static inline uint8_t to_byte(float a) {
+  a = a * 255.0f + 0.5f;
+  return a <= 0.0f ? 0 : a >= 255.0f ? 255 : (uint8_t) a;
+}
+
+static inline int ends_with(const char *s, const char *suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+// Y4M readers take 4:4:4 as limited range unless told otherwise, so say so outright
+retcode write_y4m_header(FILE *f, int width, int height, int fps) {
+  retfail(-(fprintf(f, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444 XCOLORRANGE=LIMITED\n", width,
+      height, fps) < 0));
+  return SUCCESS;
+}
+
+// a in [0, 1] to the byte range [lo, lo + span]
+static inline uint8_t to_limited(float a, float lo, float span) {
+  return to_byte((lo + span * a) / 255.0f);
+}
+
+// rgb is [height][width][3] in [0, 1], written as limited range BT.601 planar 4:4:4:
+// Y in 16..235, Cb and Cr in 16..240
+retcode write_y4m_frame(FILE *f, const float *rgb, int width, int height) {
+  const int pixels = width * height;
+  uint8_t planes[3][pixels];
+  for (int p = 0; p < pixels; ++p) {
+    const float r = rgb[p * 3], g = rgb[p * 3 + 1], b = rgb[p * 3 + 2];
+    planes[0][p] = to_limited(0.299f * r + 0.587f * g + 0.114f * b, 16, 219);
+    planes[1][p] = to_limited(-0.168736f * r - 0.331264f * g + 0.5f * b + 0.5f, 16, 224);
+    planes[2][p] = to_limited(0.5f * r - 0.418688f * g - 0.081312f * b + 0.5f, 16, 224);
+  }
+  retfail(-(fputs("FRAME\n", f) < 0));
+  retfail(-(fwrite(planes, 1, sizeof(planes), f) != sizeof(planes)));
+  return SUCCESS;
+}
+
+// rgb24, for ffmpeg -f rawvideo -pix_fmt rgb24
+retcode write_raw_frame(FILE *f, const float *rgb, int width, int height) {
+  const int values = width * height * 3;
+  uint8_t bytes[values];
+  for (int i = 0; i < values; ++i) {
+    bytes[i] = to_byte(rgb[i]);
+  }
+  retfail(-(fwrite(bytes, 1, sizeof(bytes), f) != sizeof(bytes)));
+  return SUCCESS;
+}
+
+static void put_le(uint8_t *p, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    p[i] = value >> (8 * i);
+  }
+}
+
+// IEEE float WAV header for frames interleaved samples, rewritten by wav_finish
+retcode write_wav_header(FILE *f, int channels, int rate, uint32_t frames) {
+  const uint32_t data = frames * channels * sizeof(float);
+  uint8_t h[44];
+  memcpy(h, "RIFF", 4);
+  put_le(h + 4, 36 + data, 4);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  put_le(h + 16, 16, 4);
+  put_le(h + 20, 3, 2); // WAVE_FORMAT_IEEE_FLOAT
+  put_le(h + 22, channels, 2);
+  put_le(h + 24, rate, 4);
+  put_le(h + 28, rate * channels * sizeof(float), 4);
+  put_le(h + 32, channels * sizeof(float), 2);
+  put_le(h + 34, 8 * sizeof(float), 2);
+  memcpy(h + 36, "data", 4);
+  put_le(h + 40, data, 4);
+  retfail(-(fwrite(h, 1, sizeof(h), f) != sizeof(h)));
+  return SUCCESS;
+}
+
+// little endian float samples, the same layout portaudio gets with paFloat32
+retcode write_wav_samples(FILE *f, const float *samples, size_t count) {
+  uint8_t bytes[count * sizeof(float)];
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t bits;
+    memcpy(&bits, &samples[i], sizeof(bits));
+    put_le(bytes + i * sizeof(float), bits, 4);
+  }
+  retfail(-(fwrite(bytes, 1, sizeof(bytes), f) != sizeof(bytes)));
+  return SUCCESS;
+}
+
+// patch the sizes now that the length is known
+retcode wav_finish(FILE *f, int channels, int rate, uint32_t frames) {
+  retfail(fseek(f, 0, SEEK_SET));
+  retfail(write_wav_header(f, channels, rate, frames));
+  return SUCCESS;
+}
+#endif
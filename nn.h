@@ -23,23 +23,36 @@
 #include <math.h> // for all the math functions
 #include <stdint.h> // for uint32_t's
 #include <stdio.h> // for putchar, fprintf
-#include <stdlib.h> // for rand
+#include <stdlib.h>
 #include <string.h> // for strerror
 #include <sys/mman.h> // for mmap
 #include <sys/stat.h> // for open
 #include <unistd.h> // for read
 
 #include "err.h"
+#include "rng.h"
+#include "simd.h"
+#include "threadpool.h"
 
 typedef struct matrix {
   size_t x, y;
   float *e;
 } matrix;
+// activations[r][c] = f(zvals[r][c] + bias[c]) over a rows x cols block, may run in place
+typedef void (*activate_fn)(float *activations, const float *zvals, const float *bias,
+                            size_t rows, size_t cols);
 struct neural_layer {
   matrix weights, w_delt, biases, b_delt, activations, zvals;
-  float(*activate)(float zval, float bias);
+  activate_fn activate;
   float(*backprop)(float weight);
 };
+// Inference only: one bias row per layer, no gradients and no per-layer batch buffers.
+// The batch streams through tile sized scratch, see feedforward_inference().
+struct inference_layer {
+  matrix weights; // inputs x neurons
+  float *bias;    // neurons
+  activate_fn activate;
+};
 struct dataset {
   uint32_t images, rows, columns;
   uchar *pixels;
@@ -111,13 +124,93 @@ retcode load_mnist(struct dataset *dat, char *image_file_name, char *label_file_
 
   return SUCCESS;
 }
+// view of rows [begin, end) of mat, shares its storage
+static inline matrix matrix_rows(struct matrix mat, size_t begin, size_t end) {
+  return (matrix) { .x = end - begin, .y = mat.y, .e = mat.e + begin * mat.y };
+}
 void matrix_zero(struct matrix mat) {
   memset(mat.e, 0, mat.x * mat.y * sizeof(float));
 }
+/* Skinny shapes (the cppn is K, N <= 20) spend more time in sgemm's packing and dispatch
+ * than in arithmetic. When all of b fits in registers, walk a few rows of a at a time and
+ * keep the accumulators for those rows live instead. Common shapes get a copy with K and N
+ * fixed at compile time so the compiler can fully unroll and vectorize them. */
+#define SMALL_GEMM_MAX 32
+#define SMALL_GEMM_ROWS 4
+typedef void (*small_gemm_fn)(const float *a, const float *b, float *c, size_t rows,
+                              size_t K, size_t N);
+static inline __attribute__((always_inline)) void small_gemm_body(const float *restrict a, const float *restrict b,
+                                                          float *restrict c, size_t rows,
+                                                          const size_t K, const size_t N) {
+  size_t i = 0;
+  for (; i + SMALL_GEMM_ROWS <= rows; i += SMALL_GEMM_ROWS) {
+    float acc[SMALL_GEMM_ROWS][SMALL_GEMM_MAX] = { { 0 } };
+    for (size_t k = 0; k < K; ++k) {
+      for (size_t r = 0; r < SMALL_GEMM_ROWS; ++r) {
+        const float aik = a[(i + r) * K + k];
+        for (size_t n = 0; n < N; ++n) {
+          acc[r][n] += aik * b[k * N + n];
+        }
+      }
+    }
+    for (size_t r = 0; r < SMALL_GEMM_ROWS; ++r) {
+      memcpy(c + (i + r) * N, acc[r], N * sizeof(float));
+    }
+  }
+  for (; i < rows; ++i) {
+    float acc[SMALL_GEMM_MAX] = { 0 };
+    for (size_t k = 0; k < K; ++k) {
+      const float aik = a[i * K + k];
+      for (size_t n = 0; n < N; ++n) {
+        acc[n] += aik * b[k * N + n];
+      }
+    }
+    memcpy(c + i * N, acc, N * sizeof(float));
+  }
+}
+#define DEFINE_SMALL_GEMM(K, N) \
+  static void small_gemm_##K##x##N(const float *a, const float *b, float *c, size_t rows, \
+                                   size_t k, size_t n) { \
+    small_gemm_body(a, b, c, rows, K, N); \
+  }
+DEFINE_SMALL_GEMM(3, 20)
+DEFINE_SMALL_GEMM(20, 20)
+DEFINE_SMALL_GEMM(20, 3)
+DEFINE_SMALL_GEMM(3, 3)
+static void small_gemm_any(const float *a, const float *b, float *c, size_t rows,
+                           size_t K, size_t N) {
+  small_gemm_body(a, b, c, rows, K, N);
+}
+static const struct {
+  size_t K, N;
+  small_gemm_fn gemm;
+} small_gemms[] = {
+  { 3, 20, small_gemm_3x20 },
+  { 20, 20, small_gemm_20x20 },
+  { 20, 3, small_gemm_20x3 },
+  { 3, 3, small_gemm_3x3 },
+};
+// the kernel for b's shape, or NULL when b is too big for registers
+static small_gemm_fn small_gemm_for(struct matrix b) {
+  if (b.x > SMALL_GEMM_MAX || b.y > SMALL_GEMM_MAX) {
+    return NULL;
+  }
+  for (size_t i = 0; i < sizeof(small_gemms) / sizeof(small_gemms[0]); ++i) {
+    if (small_gemms[i].K == b.x && small_gemms[i].N == b.y) {
+      return small_gemms[i].gemm;
+    }
+  }
+  return small_gemm_any;
+}
 void matmul(struct matrix a, struct matrix b, struct matrix result) {
   assert(a.y == b.x);
   assert(result.x == a.x);
   assert(result.y == b.y);
+  small_gemm_fn gemm = small_gemm_for(b);
+  if (gemm) {
+    gemm(a.e, b.e, result.e, result.x, b.x, b.y);
+    return;
+  }
   float alpha = 1.0;
   float beta = 0.0;
   cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, result.x, result.y,
@@ -144,40 +237,35 @@ void Tmatmul(struct matrix a, struct matrix b, struct matrix result) {
     alpha, a.e, a.y, b.e, b.y, beta, result.e, result.y);
 }
 // gaussian distribution with a standard deviation of sigma and an average of mu
-// generated using mox-muller transform
-void randomize(float *data, size_t count, float sigma) {
-  static const float two_pi = 2.0 * 3.14159265358979323846;
+// generated using box-muller, 2 * VLEN normals per pass from VLEN uniform pairs
+void randomize(struct rng *rng, float *data, size_t count, float sigma) {
+  static const float pi = 3.14159265358979323846;
   static const float mu = 0.0;
 
-  for (size_t i = 0; i < count; i += 2) {
-    float u1, u2;
-
-    do {
-      u1 = (float) rand() * (1.0f / RAND_MAX);
-      u2 = (float) rand() * (1.0f / RAND_MAX);
-    } while (u1 <= FLT_MIN);
-
-    data[i] = sqrtf(-2.0 * logf(u1)) * cosf(two_pi * u2) * sigma + mu;
-
-    if (i + 1 < count) {
-      data[i + 1] = sqrtf(-2.0 * logf(u1)) * sinf(two_pi * u2) * sigma + mu;
+  for (size_t i = 0; i < count; i += 2 * VLEN) {
+    float u1[VLEN], u2[VLEN], normals[2 * VLEN];
+    for (int k = 0; k < VLEN; ++k) {
+      u1[k] = rng_uniform(rng);
+      u2[k] = rng_uniform(rng);
     }
+    vfloat radius = v_mul(v_sqrt(v_mul(v_set1(-2.0f), v_log(v_load(u1)))), v_set1(sigma));
+    // angle 2 pi u2 - pi through its half angle in (-pi/2, pi/2]
+    vfloat s = v_sin_half(v_fma(v_load(u2), v_set1(pi), v_set1(-0.5f * pi)));
+    vfloat c = v_sqrt(v_max(v_sub(v_set1(1.0f), v_mul(s, s)), v_set1(0.0f)));
+    vfloat cos_angle = v_sub(v_set1(1.0f), v_mul(v_add(s, s), s));
+    vfloat sin_angle = v_mul(v_add(s, s), c);
+    v_store(normals, v_fma(radius, cos_angle, v_set1(mu)));
+    v_store(normals + VLEN, v_fma(radius, sin_angle, v_set1(mu)));
+    memcpy(data + i, normals, (count - i < 2 * VLEN ? count - i : 2 * VLEN) * sizeof(float));
   }
 }
 // fisher-yates shuffle
-void shuffle(int *data, const size_t count) {
+void shuffle(struct rng *rng, int *data, const size_t count) {
   for (int i = count - 1; i > 0; --i) {
-    int j = 0;
-
-    do { // clip the top to make uniform random
-      j = rand();
-    } while (j > RAND_MAX - (RAND_MAX % i));
-
-    j = j % i;
-    // swap
-    data[i] ^= data[j];
-    data[j] ^= data[i];
-    data[i] ^= data[j];
+    int j = rng_below(rng, i + 1);
+    int swap = data[i];
+    data[i] = data[j];
+    data[j] = swap;
   }
 }
 float gaussian_activate(float zval, float bias) {
@@ -210,22 +298,161 @@ float relu_prime(float zval, float activation) {
 }
 
 
-matrix feedforward(struct neural_layer layer[], const int neural_layers) {
-  // propigate the layers
-  for (int j = 1; j < neural_layers; ++j) {
-    matrix_zero(layer[j].zvals);
-    matrix_zero(layer[j].activations);
-    matmul(layer[j - 1].activations, layer[j].weights, layer[j].zvals);
+// exact keeps the vector activations within a few ulp of libm, fast trades that for ~1e-4
+// per activation, which compounds to ~2e-3 on the network's output
+enum activation_precision { ACTIVATE_FAST, ACTIVATE_EXACT };
+static volatile int ACTIVATION_PRECISION = ACTIVATE_FAST;
+
+enum activation_kind { GAUSSIAN, TANH, RELU };
+static inline vfloat activate_vec(enum activation_kind kind, vfloat sum_term, int exact) {
+  switch (kind) {
+  case GAUSSIAN:
+    return v_exp(v_mul(v_mul(sum_term, sum_term), v_set1(-1.0f)), exact);
+  case TANH:
+    return v_tanh(sum_term, exact);
+  default:
+    return v_max(sum_term, v_set1(0.0f));
+  }
+}
+// The bias repeats every cols floats, so lay it out once over cols * VLEN floats
+// (VLEN whole rows) and every vector in such a chunk finds its bias at the same offset.
+#define MAX_ACTIVATE_COLS 256
+static inline void activate_block(enum activation_kind kind, float *activations, const float *zvals,
+                                  const float *bias, size_t rows, size_t cols) {
+  const int exact = ACTIVATION_PRECISION == ACTIVATE_EXACT;
+  const size_t count = rows * cols;
+  size_t i = 0;
 
-    for (int i = 0; i < layer[j].activations.x; ++i) {
-      for (int k = 0; k < layer[j].activations.y; ++k) {
-        layer[j].activations.e[i * layer[j].activations.y + k] =
-          layer[j].activate(layer[j].zvals.e[i * layer[j].zvals.y + k], layer[j].biases.e[k]);
+  if (cols <= MAX_ACTIVATE_COLS) {
+    const size_t chunk = cols * VLEN;
+    float bias_tile[MAX_ACTIVATE_COLS * VLEN];
+    for (size_t r = 0; r < VLEN; ++r) {
+      memcpy(bias_tile + r * cols, bias, cols * sizeof(float));
+    }
+    for (; i + chunk <= count; i += chunk) {
+      for (size_t k = 0; k < chunk; k += VLEN) {
+        vfloat sum_term = v_add(v_load(zvals + i + k), v_load(bias_tile + k));
+        v_store(activations + i + k, activate_vec(kind, sum_term, exact));
       }
     }
   }
+  // leftover rows go through the same kernel one padded vector at a time
+  for (; i < count; i += VLEN) {
+    float tail[VLEN] = { 0 };
+    const size_t n = count - i < VLEN ? count - i : VLEN;
+    for (size_t k = 0; k < n; ++k) {
+      tail[k] = zvals[i + k] + bias[(i + k) % cols];
+    }
+    v_store(tail, activate_vec(kind, v_load(tail), exact));
+    memcpy(activations + i, tail, n * sizeof(float));
+  }
+}
+void gaussian_activate_rows(float *activations, const float *zvals, const float *bias,
+                            size_t rows, size_t cols) {
+  activate_block(GAUSSIAN, activations, zvals, bias, rows, cols);
+}
+void tanh_activate_rows(float *activations, const float *zvals, const float *bias,
+                        size_t rows, size_t cols) {
+  activate_block(TANH, activations, zvals, bias, rows, cols);
+}
+void relu_activate_rows(float *activations, const float *zvals, const float *bias,
+                        size_t rows, size_t cols) {
+  activate_block(RELU, activations, zvals, bias, rows, cols);
+}
+
+matrix feedforward(struct neural_layer layer[], const int neural_layers) {
+  // propigate the layers, sgemm and the activations overwrite everything so no zeroing
+  for (int j = 1; j < neural_layers; ++j) {
+    matmul(layer[j - 1].activations, layer[j].weights, layer[j].zvals);
+    layer[j].activate(layer[j].activations.e, layer[j].zvals.e, layer[j].biases.e,
+                      layer[j].activations.x, layer[j].activations.y);
+  }
 
   const int last = neural_layers - 1;
   return layer[last].activations;
 }
+
+// result = activate(a * b + bias), with small shapes applying the activation every few
+// rows while the products are still in registers/L1
+#define FUSED_ROWS 32
+void matmul_activate(struct matrix a, struct matrix b, const float *bias, activate_fn activate,
+                     struct matrix result) {
+  small_gemm_fn gemm = small_gemm_for(b);
+  if (!gemm) {
+    matmul(a, b, result);
+    activate(result.e, result.e, bias, result.x, result.y);
+    return;
+  }
+  assert(a.y == b.x && result.x == a.x && result.y == b.y);
+  for (size_t row = 0; row < result.x; row += FUSED_ROWS) {
+    const size_t rows = result.x - row < FUSED_ROWS ? result.x - row : FUSED_ROWS;
+    float *c = result.e + row * result.y;
+    gemm(a.e + row * a.y, b.e, c, rows, b.x, b.y);
+    activate(c, c, bias, rows, result.y);
+  }
+}
+
+#define FEEDFORWARD_GRAIN 64
+#define FEEDFORWARD_TILE 128
+// Optional replacement for input * weights on the first layer: fill zvals (rows x cols)
+// for batch rows [row, row + rows) from whatever the caller knows about its inputs.
+typedef void (*first_layer_fn)(void *context, float *zvals, size_t row, size_t rows, size_t cols);
+struct feedforward_job {
+  const struct inference_layer *layer;
+  int layers;
+  size_t widest;
+  matrix input, output;
+  first_layer_fn first_layer;
+  void *context;
+};
+// Rows are independent, so every worker pushes its own row range through all layers
+// without waiting on the others between layers. Within that range it goes a tile at a
+// time, ping-ponging the hidden activations between two tile buffers that stay in L1/L2;
+// only the input and the output rows ever touch batch sized memory.
+static void feedforward_rows(void *context, size_t begin, size_t end, int worker) {
+  struct feedforward_job *job = context;
+  const struct inference_layer *layer = job->layer;
+  const int last = job->layers - 1;
+  float tiles[2][FEEDFORWARD_TILE * job->widest];
+
+  for (size_t row = begin; row < end; row += FEEDFORWARD_TILE) {
+    const size_t rows = end - row < FEEDFORWARD_TILE ? end - row : FEEDFORWARD_TILE;
+    matrix input = { .x = rows, .y = job->input.y, .e = NULL };
+
+    for (int j = 0; j <= last; ++j) {
+      matrix output = { .x = rows, .y = layer[j].weights.y, .e = tiles[j % 2] };
+      if (j == last) {
+        output = matrix_rows(job->output, row, row + rows);
+      }
+      if (j == 0 && job->first_layer) {
+        job->first_layer(job->context, output.e, row, output.x, output.y);
+        layer[j].activate(output.e, output.e, layer[j].bias, output.x, output.y);
+      } else {
+        if (j == 0) {
+          input = matrix_rows(job->input, row, row + rows);
+        }
+        matmul_activate(input, layer[j].weights, layer[j].bias, layer[j].activate, output);
+      }
+      input = output;
+    }
+  }
+}
+// input is batch x inputs and may have no storage when first_layer builds layer 0 itself,
+// output is batch x the last layer's neurons
+matrix feedforward_inference(struct thread_pool *pool, const struct inference_layer layer[],
+                             const int layers, matrix input, matrix output,
+                             first_layer_fn first_layer, void *context) {
+  struct feedforward_job job = {
+    .layer = layer, .layers = layers, .widest = 1, .input = input, .output = output,
+    .first_layer = first_layer, .context = context,
+  };
+  assert(output.x == input.x && output.y == layer[layers - 1].weights.y);
+  for (int j = 0; j < layers; ++j) {
+    if (layer[j].weights.y > job.widest) {
+      job.widest = layer[j].weights.y;
+    }
+  }
+  pool_run(pool, feedforward_rows, &job, input.x, FEEDFORWARD_GRAIN);
+  return output;
+}
 #endif
@@ -0,0 +1,99 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+/* Streaming rational resampler for interleaved stereo, up/down = out_rate/in_rate in
+ * lowest terms. The prototype is a Blackman windowed sinc split into `up` polyphase
+ * branches of `taps` coefficients, so each output frame costs one taps-long dot product
+ * per channel whatever the ratio. Everything is allocated up front: resample_input() and
+ * resample_output() are safe to call from the audio callback. */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+
+#define RESAMPLE_CHUNK 1024 // most output frames per resample_output()
+
+struct resampler {
+  int up, down, taps;
+  int phase; // in [0, up), how far the next output is past history[0] in 1/up frames
+  float *coeffs; // [up][taps], branch p applied to history[i .. i + taps)
+  float *history; // [taps + RESAMPLE_CHUNK * down / up + 1][2]
+  size_t inputs; // frames resample_input() asked for, not yet used
+};
+
+static int gcd(int a, int b) {
+  while (b) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// rates in whole hertz, so that up/down reduced by their gcd keep the step exact
+retcode resampler_init(struct resampler *r, int in_rate, int out_rate, int taps) {
+  retfail(-(in_rate <= 0 || out_rate <= 0));
+  const int g = gcd(in_rate, out_rate);
+  r->up = out_rate / g;
+  r->down = in_rate / g;
+  r->taps = taps;
+  r->phase = 0;
+  r->inputs = 0;
+  const size_t history = taps + (size_t) RESAMPLE_CHUNK * r->down / r->up + 1;
+  r->coeffs = malloc((size_t) r->up * taps * sizeof(float));
+  r->history = calloc(history * 2, sizeof(float));
+  retfail(-(r->coeffs == NULL || r->history == NULL));
+
+  // low pass at the lower nyquist, a little inside it for the transition band
+  const int length = r->up * taps;
+  const double cutoff = 0.45 * (r->up < r->down ? 1.0 : (double) r->down / r->up) / r->down;
+  const double centre = (length - 1) / 2.0;
+  for (int p = 0; p < r->up; ++p) {
+    double sum = 0;
+    for (int t = 0; t < taps; ++t) {
+      const int n = (taps - 1 - t) * r->up + p;
+      const double x = n - centre;
+      const double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+      const double window = 0.42 - 0.5 * cos(2 * M_PI * n / (length - 1)) +
+          0.08 * cos(4 * M_PI * n / (length - 1));
+      r->coeffs[p * taps + t] = sinc * window;
+      sum += sinc * window;
+    }
+    for (int t = 0; t < taps; ++t) { // unity gain at dc in every branch
+      r->coeffs[p * taps + t] /= sum;
+    }
+  }
+  return SUCCESS;
+}
+
+// where to write the *inputs stereo frames that outputs (<= RESAMPLE_CHUNK) frames need
+static inline float *resample_input(struct resampler *r, size_t outputs, size_t *inputs) {
+  r->inputs = (r->phase + outputs * r->down) / r->up;
+  *inputs = r->inputs;
+  return r->history + 2 * r->taps;
+}
+
+// outputs stereo frames into out, once the inputs are in place
+static inline void resample_output(struct resampler *r, float *out, size_t outputs) {
+  const int taps = r->taps;
+  size_t i = 0;
+  int phase = r->phase;
+  for (size_t k = 0; k < outputs; ++k) {
+    const float *h = r->coeffs + phase * taps;
+    const float *x = r->history + 2 * i;
+    float left = 0, right = 0;
+    for (int t = 0; t < taps; ++t) {
+      left += h[t] * x[2 * t];
+      right += h[t] * x[2 * t + 1];
+    }
+    out[2 * k] = left;
+    out[2 * k + 1] = right;
+    phase += r->down;
+    i += phase / r->up;
+    phase %= r->up;
+  }
+  r->phase = phase;
+  // the last taps frames are the next call's history
+  memmove(r->history, r->history + 2 * r->inputs, 2 * taps * sizeof(float));
+}
+#endif
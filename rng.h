@@ -0,0 +1,60 @@
+#ifndef RNG_H
+#define RNG_H
+/* xoshiro256** with splitmix64 seeding. Each thread that draws numbers owns a
+ * struct rng, so nothing is shared or locked, and a (seed, stream) pair always
+ * replays the same sequence no matter how the threads interleave. */
+#include <stdint.h>
+
+struct rng {
+  uint64_t s[4];
+};
+
+static inline uint64_t splitmix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+// independent streams of one seed for different threads / purposes
+void rng_seed(struct rng *rng, uint64_t seed, uint64_t stream) {
+  uint64_t x = seed ^ splitmix64(&stream);
+  for (int i = 0; i < 4; ++i) {
+    rng->s[i] = splitmix64(&x);
+  }
+}
+
+static inline uint64_t rotl64(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(struct rng *rng) {
+  uint64_t *s = rng->s;
+  const uint64_t result = rotl64(s[1] * 5, 7) * 9;
+  const uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl64(s[3], 45);
+  return result;
+}
+
+// uniform in (0, 1], never 0 so it is safe to take the log of
+static inline float rng_uniform(struct rng *rng) {
+  return (float) ((rng_next(rng) >> 40) + 1) * (1.0f / 16777216.0f);
+}
+
+// uniform in [0, bound) without modulo bias (Lemire's multiply and reject)
+static inline uint32_t rng_below(struct rng *rng, uint32_t bound) {
+  uint64_t m = (rng_next(rng) >> 32) * bound;
+  if ((uint32_t) m < bound) {
+    const uint32_t floor = -bound % bound;
+    while ((uint32_t) m < floor) {
+      m = (rng_next(rng) >> 32) * bound;
+    }
+  }
+  return m >> 32;
+}
+#endif
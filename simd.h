@@ -0,0 +1,274 @@
+#ifndef SIMD_H
+#define SIMD_H
+/* Thin wrappers over the widest float vector the compiler was allowed to use
+ * (./run builds with -march=native). Everything falls back to plain floats,
+ * so code written against vfloat compiles everywhere, just narrower. */
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// IEEE half precision bits of a, rounded to nearest even, for targets without F16C
+static inline uint16_t half_bits(float a) {
+  uint32_t x;
+  memcpy(&x, &a, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000, abs = x & 0x7fffffff;
+  if (abs >= 0x47800000) { // too big for a half, or inf / nan
+    return sign | (abs > 0x7f800000 ? 0x7e00 : 0x7c00);
+  }
+  if (abs < 0x38800000) { // subnormal half, let the fpu do the rounding
+    float f;
+    memcpy(&f, &abs, sizeof(f));
+    return sign | (uint16_t) nearbyintf(f * 16777216.0f);
+  }
+  const uint32_t bits = abs - 0x38000000;
+  return sign | ((bits + 0xfff + ((bits >> 13) & 1)) >> 13);
+}
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define VLEN 16
+typedef __m512 vfloat;
+typedef __m512i vint;
+static inline vfloat v_load(const float *p) { return _mm512_loadu_ps(p); }
+static inline void v_store(float *p, vfloat a) { _mm512_storeu_ps(p, a); }
+static inline vfloat v_set1(float a) { return _mm512_set1_ps(a); }
+static inline void v_store_half(uint16_t *p, vfloat a) {
+  _mm256_storeu_si256((__m256i *) p, _mm512_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+}
+static inline vfloat v_add(vfloat a, vfloat b) { return _mm512_add_ps(a, b); }
+static inline vfloat v_sub(vfloat a, vfloat b) { return _mm512_sub_ps(a, b); }
+static inline vfloat v_mul(vfloat a, vfloat b) { return _mm512_mul_ps(a, b); }
+static inline vfloat v_div(vfloat a, vfloat b) { return _mm512_div_ps(a, b); }
+static inline vfloat v_sqrt(vfloat a) { return _mm512_sqrt_ps(a); }
+static inline vfloat v_fma(vfloat a, vfloat b, vfloat c) { return _mm512_fmadd_ps(a, b, c); }
+static inline vfloat v_max(vfloat a, vfloat b) { return _mm512_max_ps(a, b); }
+static inline vfloat v_min(vfloat a, vfloat b) { return _mm512_min_ps(a, b); }
+static inline vfloat v_round(vfloat a) {
+  return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+static inline vfloat v_abs(vfloat a) {
+  return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_set1_epi32(0x7fffffff)));
+}
+// copy the sign of s onto the magnitude of a
+static inline vfloat v_copysign(vfloat a, vfloat s) {
+  __m512i sign = _mm512_and_si512(_mm512_castps_si512(s), _mm512_set1_epi32(0x80000000));
+  return _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(v_abs(a)), sign));
+}
+// 2^n for integral valued n in [-126, 127]
+static inline vfloat v_pow2n(vfloat n) {
+  __m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+  return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+}
+// a = m * 2^e with m in [0.5, 1), for positive normal a
+static inline vfloat v_frexp(vfloat a, vfloat *e) {
+  *e = _mm512_add_ps(_mm512_getexp_ps(a), _mm512_set1_ps(1.0f));
+  return _mm512_getmant_ps(a, _MM_MANT_NORM_p5_1, _MM_MANT_SIGN_src);
+}
+// lanes of a where |a| < limit, b elsewhere
+static inline vfloat v_select_small(vfloat a, vfloat b, vfloat absx, float limit) {
+  __mmask16 m = _mm512_cmp_ps_mask(absx, _mm512_set1_ps(limit), _CMP_LT_OQ);
+  return _mm512_mask_blend_ps(m, b, a);
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define VLEN 8
+typedef __m256 vfloat;
+typedef __m256i vint;
+static inline vfloat v_load(const float *p) { return _mm256_loadu_ps(p); }
+static inline void v_store(float *p, vfloat a) { _mm256_storeu_ps(p, a); }
+static inline vfloat v_set1(float a) { return _mm256_set1_ps(a); }
+static inline void v_store_half(uint16_t *p, vfloat a) {
+#ifdef __F16C__
+  _mm_storeu_si128((__m128i *) p, _mm256_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+#else
+  float f[8];
+  _mm256_storeu_ps(f, a);
+  for (int i = 0; i < 8; ++i) {
+    p[i] = half_bits(f[i]);
+  }
+#endif
+}
+static inline vfloat v_add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat v_sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat v_mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat v_div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+static inline vfloat v_sqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+static inline vfloat v_fma(vfloat a, vfloat b, vfloat c) { return _mm256_fmadd_ps(a, b, c); }
+static inline vfloat v_max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+static inline vfloat v_min(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+static inline vfloat v_round(vfloat a) {
+  return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+static inline vfloat v_abs(vfloat a) {
+  return _mm256_and_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+}
+static inline vfloat v_copysign(vfloat a, vfloat s) {
+  vfloat sign = _mm256_and_ps(s, _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000)));
+  return _mm256_or_ps(v_abs(a), sign);
+}
+static inline vfloat v_pow2n(vfloat n) {
+  __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+}
+static inline vfloat v_frexp(vfloat a, vfloat *e) {
+  __m256i bits = _mm256_castps_si256(a);
+  *e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+  bits = _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff));
+  return _mm256_castsi256_ps(_mm256_or_si256(bits, _mm256_set1_epi32(0x3f000000)));
+}
+static inline vfloat v_select_small(vfloat a, vfloat b, vfloat absx, float limit) {
+  vfloat m = _mm256_cmp_ps(absx, _mm256_set1_ps(limit), _CMP_LT_OQ);
+  return _mm256_blendv_ps(b, a, m);
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define VLEN 4
+typedef float32x4_t vfloat;
+typedef int32x4_t vint;
+static inline vfloat v_load(const float *p) { return vld1q_f32(p); }
+static inline void v_store(float *p, vfloat a) { vst1q_f32(p, a); }
+static inline vfloat v_set1(float a) { return vdupq_n_f32(a); }
+static inline void v_store_half(uint16_t *p, vfloat a) {
+  vst1_u16(p, vreinterpret_u16_f16(vcvt_f16_f32(a)));
+}
+static inline vfloat v_add(vfloat a, vfloat b) { return vaddq_f32(a, b); }
+static inline vfloat v_sub(vfloat a, vfloat b) { return vsubq_f32(a, b); }
+static inline vfloat v_mul(vfloat a, vfloat b) { return vmulq_f32(a, b); }
+static inline vfloat v_div(vfloat a, vfloat b) { return vdivq_f32(a, b); }
+static inline vfloat v_sqrt(vfloat a) { return vsqrtq_f32(a); }
+static inline vfloat v_fma(vfloat a, vfloat b, vfloat c) { return vfmaq_f32(c, a, b); }
+static inline vfloat v_max(vfloat a, vfloat b) { return vmaxq_f32(a, b); }
+static inline vfloat v_min(vfloat a, vfloat b) { return vminq_f32(a, b); }
+static inline vfloat v_round(vfloat a) { return vrndnq_f32(a); }
+static inline vfloat v_abs(vfloat a) { return vabsq_f32(a); }
+static inline vfloat v_copysign(vfloat a, vfloat s) {
+  return vbslq_f32(vdupq_n_u32(0x80000000), s, a);
+}
+static inline vfloat v_pow2n(vfloat n) {
+  int32x4_t e = vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127));
+  return vreinterpretq_f32_s32(vshlq_n_s32(e, 23));
+}
+static inline vfloat v_frexp(vfloat a, vfloat *e) {
+  int32x4_t bits = vreinterpretq_s32_f32(a);
+  *e = vcvtq_f32_s32(vsubq_s32(vshrq_n_s32(bits, 23), vdupq_n_s32(126)));
+  bits = vandq_s32(bits, vdupq_n_s32(0x007fffff));
+  return vreinterpretq_f32_s32(vorrq_s32(bits, vdupq_n_s32(0x3f000000)));
+}
+static inline vfloat v_select_small(vfloat a, vfloat b, vfloat absx, float limit) {
+  return vbslq_f32(vcltq_f32(absx, vdupq_n_f32(limit)), a, b);
+}
+
+#else
+#define VLEN 1
+typedef float vfloat;
+typedef int32_t vint;
+static inline vfloat v_load(const float *p) { return *p; }
+static inline void v_store(float *p, vfloat a) { *p = a; }
+static inline vfloat v_set1(float a) { return a; }
+static inline void v_store_half(uint16_t *p, vfloat a) { *p = half_bits(a); }
+static inline vfloat v_add(vfloat a, vfloat b) { return a + b; }
+static inline vfloat v_sub(vfloat a, vfloat b) { return a - b; }
+static inline vfloat v_mul(vfloat a, vfloat b) { return a * b; }
+static inline vfloat v_div(vfloat a, vfloat b) { return a / b; }
+static inline vfloat v_sqrt(vfloat a) { return sqrtf(a); }
+static inline vfloat v_fma(vfloat a, vfloat b, vfloat c) { return a * b + c; }
+static inline vfloat v_max(vfloat a, vfloat b) { return a > b ? a : b; }
+static inline vfloat v_min(vfloat a, vfloat b) { return a < b ? a : b; }
+static inline vfloat v_round(vfloat a) { return nearbyintf(a); }
+static inline vfloat v_abs(vfloat a) { return fabsf(a); }
+static inline vfloat v_copysign(vfloat a, vfloat s) { return copysignf(a, s); }
+static inline vfloat v_pow2n(vfloat n) {
+  int32_t e = ((int32_t) n + 127) << 23;
+  float r;
+  memcpy(&r, &e, sizeof(r));
+  return r;
+}
+static inline vfloat v_frexp(vfloat a, vfloat *e) {
+  int n;
+  a = frexpf(a, &n);
+  *e = n;
+  return a;
+}
+static inline vfloat v_select_small(vfloat a, vfloat b, vfloat absx, float limit) {
+  return absx < limit ? a : b;
+}
+#endif
+
+/* e^x by range reduction to r in [-ln2/2, ln2/2] and a polynomial in r.
+ * exact: degree 6, within ~2 ulp of expf. !exact: degree 3, ~1e-4 relative. */
+static inline vfloat v_exp(vfloat x, int exact) {
+  x = v_min(v_max(x, v_set1(-87.0f)), v_set1(88.0f));
+  vfloat n = v_round(v_mul(x, v_set1(1.44269504088896341f)));
+  vfloat r = v_fma(n, v_set1(-0.693359375f), x);
+  r = v_fma(n, v_set1(2.12194440e-4f), r);
+  vfloat p;
+  if (exact) {
+    p = v_set1(1.9875691500e-4f);
+    p = v_fma(p, r, v_set1(1.3981999507e-3f));
+    p = v_fma(p, r, v_set1(8.3334519073e-3f));
+    p = v_fma(p, r, v_set1(4.1665795894e-2f));
+    p = v_fma(p, r, v_set1(1.6666665459e-1f));
+    p = v_fma(p, r, v_set1(5.0000001201e-1f));
+    p = v_fma(v_mul(p, r), r, v_add(r, v_set1(1.0f)));
+  } else {
+    p = v_set1(0.16767012f);
+    p = v_fma(p, r, v_set1(0.50502228f));
+    p = v_fma(p, r, v_set1(0.99998493f));
+    p = v_fma(p, r, v_set1(0.99992456f));
+  }
+  return v_mul(p, v_pow2n(n));
+}
+
+/* tanh(x) = (e^2x - 1) / (e^2x + 1) on |x|, sign restored afterwards. Near zero that
+ * cancels, and with the fast v_exp tanh(0) would come out ~4e-5, so in both modes
+ * |x| < 0.625 takes the odd polynomial instead. */
+static inline vfloat v_tanh(vfloat x, int exact) {
+  vfloat ax = v_min(v_abs(x), v_set1(9.0f));
+  vfloat e = v_exp(v_add(ax, ax), exact);
+  vfloat t = v_div(v_sub(e, v_set1(1.0f)), v_add(e, v_set1(1.0f)));
+  vfloat z = v_mul(ax, ax);
+  vfloat p = v_set1(-5.70498872745e-3f);
+  p = v_fma(p, z, v_set1(2.06390887954e-2f));
+  p = v_fma(p, z, v_set1(-5.37397155531e-2f));
+  p = v_fma(p, z, v_set1(1.33314422036e-1f));
+  p = v_fma(p, z, v_set1(-3.33332819422e-1f));
+  p = v_fma(v_mul(p, z), ax, ax);
+  t = v_select_small(p, t, ax, 0.625f);
+  return v_copysign(t, x);
+}
+
+/* ln(x) for positive normal x, the Cephes logf polynomial on m in [sqrt(0.5), sqrt(2)). */
+static inline vfloat v_log(vfloat x) {
+  vfloat e;
+  vfloat m = v_frexp(x, &e);
+  const float sqrt_half = 0.707106781186547524f;
+  e = v_select_small(v_sub(e, v_set1(1.0f)), e, m, sqrt_half);
+  m = v_select_small(v_sub(v_add(m, m), v_set1(1.0f)), v_sub(m, v_set1(1.0f)), m, sqrt_half);
+  vfloat z = v_mul(m, m);
+  vfloat p = v_set1(7.0376836292e-2f);
+  p = v_fma(p, m, v_set1(-1.1514610310e-1f));
+  p = v_fma(p, m, v_set1(1.1676998740e-1f));
+  p = v_fma(p, m, v_set1(-1.2420140846e-1f));
+  p = v_fma(p, m, v_set1(1.4249322787e-1f));
+  p = v_fma(p, m, v_set1(-1.6668057665e-1f));
+  p = v_fma(p, m, v_set1(2.0000714765e-1f));
+  p = v_fma(p, m, v_set1(-2.4999993993e-1f));
+  p = v_fma(p, m, v_set1(3.3333331174e-1f));
+  p = v_mul(v_mul(p, m), z);
+  p = v_fma(e, v_set1(-2.12194440e-4f), p);
+  p = v_fma(z, v_set1(-0.5f), p);
+  return v_fma(e, v_set1(0.693359375f), v_add(m, p));
+}
+
+/* sin(x) for x in [-pi/2, pi/2], Taylor to x^9, within ~4e-6. */
+static inline vfloat v_sin_half(vfloat x) {
+  vfloat z = v_mul(x, x);
+  vfloat p = v_set1(2.7557319224e-6f);
+  p = v_fma(p, z, v_set1(-1.9841269841e-4f));
+  p = v_fma(p, z, v_set1(8.3333333333e-3f));
+  p = v_fma(p, z, v_set1(-1.6666666667e-1f));
+  return v_fma(v_mul(p, z), x, x);
+}
+#endif
@@ -0,0 +1,126 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+/* A persistent pool of pthreads that split a range of work items between them.
+ * The calling thread takes the first share, so a pool of one thread is just a
+ * function call. Sized from OMP_NUM_THREADS like the rest of the math. */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "err.h"
+
+#define MAX_POOL_THREADS 64
+
+// process items [begin, end), worker is a stable index in [0, threads) for scratch space
+typedef void (*pool_task)(void *context, size_t begin, size_t end, int worker);
+
+struct thread_pool;
+struct pool_worker {
+  struct thread_pool *pool;
+  int index;
+};
+
+struct thread_pool {
+  int threads;
+  pthread_t handles[MAX_POOL_THREADS];
+  struct pool_worker workers[MAX_POOL_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t start, done;
+  unsigned long generation;
+  int pending;
+  pool_task task;
+  void *context;
+  size_t count, grain;
+};
+
+// contiguous share of worker index, rounded to multiples of grain
+static void pool_share(const struct thread_pool *pool, int index, size_t *begin, size_t *end) {
+  size_t chunks = (pool->count + pool->grain - 1) / pool->grain;
+  size_t first = chunks * index / pool->threads;
+  size_t last = chunks * (index + 1) / pool->threads;
+  *begin = first * pool->grain;
+  *end = last * pool->grain < pool->count ? last * pool->grain : pool->count;
+}
+
+static void *pool_worker_main(void *arg) {
+  struct pool_worker *self = arg;
+  struct thread_pool *pool = self->pool;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    size_t begin, end;
+    pool_share(pool, self->index, &begin, &end);
+    if (begin < end) {
+      pool->task(pool->context, begin, end, self->index);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  return NULL;
+}
+
+int pool_default_threads() {
+  const char *env = getenv("OMP_NUM_THREADS");
+  long threads = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) {
+    threads = 1;
+  }
+  return threads > MAX_POOL_THREADS ? MAX_POOL_THREADS : threads;
+}
+
+retcode pool_init(struct thread_pool *pool, int threads) {
+  pool->threads = threads < 1 ? 1 : threads > MAX_POOL_THREADS ? MAX_POOL_THREADS : threads;
+  pool->generation = 0;
+  pool->pending = 0;
+  retfail(-pthread_mutex_init(&pool->lock, NULL));
+  retfail(-pthread_cond_init(&pool->start, NULL));
+  retfail(-pthread_cond_init(&pool->done, NULL));
+  for (int i = 1; i < pool->threads; ++i) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    retfail(-pthread_create(&pool->handles[i], NULL, pool_worker_main, &pool->workers[i]));
+  }
+  return SUCCESS;
+}
+
+// run task over [0, count) split across the pool, returns once every share is done
+void pool_run(struct thread_pool *pool, pool_task task, void *context, size_t count, size_t grain) {
+  if (pool->threads == 1) {
+    task(context, 0, count, 0);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->context = context;
+  pool->count = count;
+  pool->grain = grain ? grain : 1;
+  pool->pending = pool->threads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  size_t begin, end;
+  pool_share(pool, 0, &begin, &end);
+  if (begin < end) {
+    task(context, begin, end, 0);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+#endif
@@ -0,0 +1,214 @@
+#ifndef TIMING_H
+#define TIMING_H
+/* Per-frame stage durations on the monotonic clock. The frame thread appends one record
+ * per frame to a single producer / single consumer ring, two atomics and no locks, and
+ * never waits: if the reader is a whole ring behind the record is counted and dropped.
+ * An exporter thread drains the ring once a second and writes p50/p95/p99 per stage as
+ * one JSON line to a file or to whoever is connected to a unix socket. A stage that
+ * didn't run for a frame records 0, and its percentiles only cover the frames it ran
+ * in, counted after them: "stage":[p50,p95,p99,frames]. timing_flush sends whatever
+ * is left at exit, so short runs and the last partial second aren't lost.
+ *   KALEIDO_TIMING=/tmp/kaleido.timing   or   KALEIDO_TIMING=unix:/tmp/kaleido.sock */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "err.h"
+
+#define TIMING_STAGES 8
+#define TIMING_RING 1024 // records, a power of two
+#define TIMING_WINDOW 512 // most recent frames the percentiles cover
+#define TIMING_CLIENTS 8
+
+static inline uint64_t monotonic_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// ns since *mark, and move the mark up to now
+static inline uint32_t lap_ns(uint64_t *mark) {
+  const uint64_t now = monotonic_ns();
+  const uint64_t elapsed = now - *mark;
+  *mark = now;
+  return elapsed;
+}
+
+struct frame_timing {
+  uint32_t frame;
+  uint32_t dropped; // so far: rendered but too late to show
+  uint32_t missed; // so far: nothing ready, the last frame was shown again
+  uint32_t stage_ns[TIMING_STAGES];
+};
+
+struct timing_ring {
+  struct frame_timing records[TIMING_RING];
+  _Atomic uint64_t head; // only the frame thread writes this
+  _Atomic uint64_t tail; // only the exporter writes this
+  _Atomic uint64_t overruns;
+};
+
+static inline void timing_push(struct timing_ring *ring, const struct frame_timing *timing) {
+  const uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= TIMING_RING) {
+    atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+    return;
+  }
+  ring->records[head % TIMING_RING] = *timing;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static inline int timing_pop(struct timing_ring *ring, struct frame_timing *timing) {
+  const uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+    return 0;
+  }
+  *timing = ring->records[tail % TIMING_RING];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+struct timing_export {
+  int enabled;
+  struct timing_ring ring;
+  const char *const *names;
+  int stages;
+  FILE *file;
+  int listener; // -1 unless exporting to a socket
+  int clients[TIMING_CLIENTS];
+  int client_count;
+  struct frame_timing window[TIMING_WINDOW];
+  uint64_t seen;
+  pthread_mutex_t lock; // the ring has one reader: the exporter, or timing_flush at exit
+  pthread_t thread;
+};
+
+static int compare_u32(const void *a, const void *b) {
+  const uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+// one JSON line: the latest counters and per stage p50/p95/p99 in ms over the frames of
+// the window it ran in, and how many those were
+static int timing_format(struct timing_export *ex, char *line, size_t size) {
+  const size_t frames = ex->seen < TIMING_WINDOW ? ex->seen : TIMING_WINDOW;
+  const struct frame_timing *last = &ex->window[(ex->seen - 1) % TIMING_WINDOW];
+  int n = snprintf(line, size, "{\"frame\":%u,\"dropped\":%u,\"missed\":%u,\"overruns\":%llu",
+      last->frame, last->dropped, last->missed,
+      (unsigned long long) atomic_load(&ex->ring.overruns));
+  uint32_t ns[TIMING_WINDOW];
+  for (int s = 0; s < ex->stages; ++s) {
+    size_t ran = 0;
+    for (size_t f = 0; f < frames; ++f) {
+      if (ex->window[f].stage_ns[s]) {
+        ns[ran++] = ex->window[f].stage_ns[s];
+      }
+    }
+    if (ran == 0) {
+      ns[0] = 0;
+    }
+    qsort(ns, ran, sizeof(ns[0]), compare_u32);
+    n += snprintf(line + n, size - n, ",\"%s\":[%.3f,%.3f,%.3f,%zu]", ex->names[s],
+        ns[ran * 50 / 100] * 1e-6, ns[ran * 95 / 100] * 1e-6, ns[ran * 99 / 100] * 1e-6, ran);
+  }
+  n += snprintf(line + n, size - n, "}\n");
+  return n;
+}
+
+static void timing_send(struct timing_export *ex, const char *line, int length) {
+  if (ex->file) {
+    fputs(line, ex->file);
+    fflush(ex->file);
+    return;
+  }
+  int client;
+  while (ex->client_count < TIMING_CLIENTS && (client = accept(ex->listener, NULL, NULL)) >= 0) {
+    ex->clients[ex->client_count++] = client;
+  }
+  for (int c = 0; c < ex->client_count; ++c) {
+    if (send(ex->clients[c], line, length, MSG_DONTWAIT | MSG_NOSIGNAL) != length) {
+      close(ex->clients[c]); // gone, or too slow to keep up
+      ex->clients[c--] = ex->clients[--ex->client_count];
+    }
+  }
+}
+
+// pop everything recorded so far into the window and send a line if there was any
+static void timing_drain(struct timing_export *ex) {
+  char line[256 + 64 * TIMING_STAGES];
+  pthread_mutex_lock(&ex->lock);
+  const uint64_t seen = ex->seen;
+  while (timing_pop(&ex->ring, &ex->window[ex->seen % TIMING_WINDOW])) {
+    ex->seen++;
+  }
+  if (ex->seen != seen) {
+    timing_send(ex, line, timing_format(ex, line, sizeof(line)));
+  }
+  pthread_mutex_unlock(&ex->lock);
+}
+
+static void *timing_exporter(void *context) {
+  struct timing_export *ex = context;
+  for (;;) {
+    sleep(1);
+    timing_drain(ex);
+  }
+  return NULL;
+}
+
+static retcode timing_listen(struct timing_export *ex, const char *path) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  retfail(-(strlen(path) >= sizeof(address.sun_path)));
+  strcpy(address.sun_path, path);
+  ex->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  retfail(ex->listener);
+  unlink(path);
+  retfail(bind(ex->listener, (struct sockaddr *) &address, sizeof(address)));
+  retfail(listen(ex->listener, TIMING_CLIENTS));
+  retfail(fcntl(ex->listener, F_SETFL, O_NONBLOCK));
+  return SUCCESS;
+}
+
+// target is a file to append to, "unix:PATH" for a socket, or NULL to stay off
+retcode timing_init(struct timing_export *ex, const char *target, const char *const names[],
+    int stages) {
+  ex->names = names;
+  ex->stages = stages < TIMING_STAGES ? stages : TIMING_STAGES;
+  ex->listener = -1;
+  if (target == NULL) {
+    return SUCCESS;
+  }
+  if (strncmp(target, "unix:", 5) == 0) {
+    retfail(timing_listen(ex, target + 5));
+  } else {
+    ex->file = fopen(target, "a");
+    retfail(-(ex->file == NULL));
+  }
+  retfail(-pthread_mutex_init(&ex->lock, NULL));
+  retfail(-pthread_create(&ex->thread, NULL, timing_exporter, ex));
+  ex->enabled = 1;
+  return SUCCESS;
+}
+
+// send the frames recorded since the exporter last woke, for the end of a run
+void timing_flush(struct timing_export *ex) {
+  if (ex->enabled) {
+    timing_drain(ex);
+  }
+}
+
+static inline void timing_record(struct timing_export *ex, const struct frame_timing *timing) {
+  if (ex->enabled) {
+    timing_push(&ex->ring, timing);
+  }
+}
+#endif